@@ -7,3 +7,6 @@ APP_ABI := armeabi-v7a arm64-v8a x86 x86_64
 
 # Min runtime API level
 APP_PLATFORM=android-15
+
+# C++17 for the aligned allocation of the 16 bytes aligned phygine types.
+APP_CPPFLAGS := -std=c++17
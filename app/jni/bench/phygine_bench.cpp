@@ -0,0 +1,348 @@
+/**
+ * Microbenchmarks of phygine, built on the host without any window (PHYGINE_HEADLESS).
+ *
+ * Each benchmark runs at 1k, 10k, 100k and 1M particles and reports the time per particle:
+ *  - integrate: one ParticleStore::integrate step,
+ *  - update: one FireworksDemo::update step where nothing expires,
+ *  - update_runtime: the same step, with the generic rule code instead of the compiled kernels,
+ *  - expiry: one FireworksDemo::update step where every firework expires (no payload),
+ *  - spawn: launching fireworks into an empty pool,
+ *  - burst: one FireworksDemo::update step where 10 fireworks expire into all the particles,
+ *  - particle: Particle::integrate over an array of Particle objects (Vector3 maths),
+ *  - forces: ForceRegistry::updateForces with buoyancy and gravity generators on every particle,
+ *    registered particle by particle, so that both generators go through a chunk while it is
+ *    in the cache,
+ *  - forces_each: the same forces, with one virtual updateForce call per particle and generator
+ *    (what the registry did before grouping them by generator),
+ *  - contacts: generating and resolving the contacts of chains of 10 particles linked by rods and
+ *    falling through the ground, with the batches resolved across the cores,
+ *  - grid_build: SpatialGrid::build over particles spread on a 1024x2048 area,
+ *  - grid_query: one SpatialGrid::queryRadius of radius 32 in that area, timed per query rather
+ *    than per particle,
+ *  - raster_over, raster_add: ParticleRaster::draw of 5x5 soft discs on a 1080x1920 frame, painted
+ *    over or added, on one core (25 pixels per particle, less the rim),
+ *  - raster_jobs: raster_over with the bands drawn across the cores.
+ *
+ * Vector3 uses SIMD instructions unless PHYGINE_NO_SIMD is defined: phygine_bench_scalar is built
+ * that way, to compare both. phygine_bench_fixed is built with PHYGINE_FIXED_POINT, to compare
+ * fixed-point reals with floats. It first checks that pow and exp2 saturate at the top of the
+ * fixed-point range, and fails if they do not.
+ *
+ * Usage: phygine_bench [results.csv]
+ * The results are printed as a table, and written as CSV (benchmark,particles,ns_per_particle,
+ * iterations) to the given file, so they can be compared between runs.
+ */
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "phygine/Fireworks.cpp"
+#include "phygine/ForceRegistry.cpp"
+#include "phygine/ParticleBuoyancy.cpp"
+#include "phygine/ParticleGravity.cpp"
+#include "phygine/SpatialGrid.cpp"
+#include "phygine/ParticleLinks.cpp"
+#include "phygine/ParticleGround.cpp"
+#include "utils/ParticleRaster.cpp"
+
+static const unsigned SIZES[] = {1000, 10000, 100000, 1000000};
+
+/** Minimum time spent measuring each benchmark, in seconds. */
+static const double MIN_DURATION = 0.2;
+
+static const real STEP = 1.0f / 60;
+
+/** Where the benchmarks whose result is not otherwise used write it, so that it is computed. */
+static volatile unsigned long long sink;
+
+struct Result {
+    std::string name;
+    unsigned particles;
+    double nsPerParticle;
+    unsigned iterations;
+};
+
+static std::vector<Result> results;
+
+/** Rule index of a firework type without payload. */
+static const unsigned LEAF_RULE = 2;
+
+/** Rule index of the runtime rule of the burst benchmark, and its number of fireworks. */
+static const unsigned BURST_RULE = 5;
+static const unsigned BURST_PARENTS = 10;
+
+/**
+ * Times run() until MIN_DURATION is spent. setup() is called before each run and is not timed.
+ * The time is reported per particle, or per operation when run() does a given number of them.
+ */
+template<typename Setup, typename Run>
+static void measure(const std::string &name, unsigned particles, Setup setup, Run run, unsigned operations = 0) {
+    typedef std::chrono::steady_clock Clock;
+
+    double total = 0;
+    unsigned iterations = 0;
+    while (total < MIN_DURATION || iterations < 3) {
+        setup();
+
+        const Clock::time_point start = Clock::now();
+        run();
+        total += std::chrono::duration<double>(Clock::now() - start).count();
+        iterations++;
+    }
+
+    const double ns = total * 1e9 / iterations / (operations ? operations : particles);
+    results.push_back({name, particles, ns, iterations});
+
+    std::cout << std::left << std::setw(16) << name << std::right << std::setw(10) << particles
+              << std::setw(12) << std::fixed << std::setprecision(3) << ns << (operations ? " ns/op" : " ns/particle") << std::endl;
+}
+
+/**
+ * Puts the particles high enough in the air not to hit the ground, with a fresh velocity.
+ * Running many steps in a row would otherwise damp the velocities down to denormals, which are
+ * very slow on x86 and never happen in the game.
+ */
+static void resetMotion(ParticleStore &store) {
+    for (unsigned i = 0; i < store.size(); i++) {
+        store.positionY[i] = store.previousY[i] = 1000;
+        store.velocityX[i] = store.velocityY[i] = store.velocityZ[i] = 10;
+        store.age[i] = 1000;
+    }
+}
+
+/** Fills the demo with leaf fireworks. */
+static void fillDemo(FireworksDemo &demo, unsigned count) {
+    demo.clear();
+    demo.launch(LEAF_RULE, count);
+    resetMotion(demo.getStore(LEAF_RULE));
+}
+
+#ifdef PHYGINE_FIXED_POINT
+/**
+ * Checks pow and exp2 at and just past the top of the fixed-point range, where the results used
+ * to wrap around to negative values. Returns false, logging the failures, if any is wrong.
+ */
+static bool checkFixedLimits() {
+    struct Case {
+        const char *name;
+        Fixed value;
+        double expected;
+    };
+    const double top = (double) Fixed::max();
+    const Case cases[] = {
+            {"exp2(14)", fixedExp2(14), 16384},
+            {"exp2(14.5)", fixedExp2(14.5f), 23170.475},
+            {"exp2(15)", fixedExp2(15), top},
+            {"exp2(15.9)", fixedExp2(15.9f), top},
+            {"exp2(20)", fixedExp2(20), top},
+            {"exp2(-20)", fixedExp2(-20), 0},
+            {"pow(2, 14)", fixedPow(2, 14), 16384},
+            {"pow(2, 15)", fixedPow(2, 15), top},
+            {"pow(2, 15.9)", fixedPow(2, 15.9f), top},
+    };
+
+    bool ok = true;
+    for (const Case &check : cases) {
+        const double value = (double) check.value;
+        // Within 0.01%, or 2^-14 near 0.
+        const double tolerance = check.expected * 1e-4 > 1.0 / 16384 ? check.expected * 1e-4 : 1.0 / 16384;
+        if (value < check.expected - tolerance || value > check.expected + tolerance) {
+            std::cerr << check.name << " gives " << value << " instead of " << check.expected << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+#ifdef PHYGINE_FIXED_POINT
+    if (!checkFixedLimits()) return EXIT_FAILURE;
+#endif
+
+    for (unsigned size : SIZES) {
+        {
+            FireworksDemo demo(size);
+            fillDemo(demo, size);
+            ParticleStore &store = demo.getStore(LEAF_RULE);
+
+            measure("integrate", size, [&]() { resetMotion(store); }, [&]() { store.integrate(STEP); });
+            measure("update", size, [&]() { resetMotion(store); }, [&]() { demo.update(STEP); });
+
+            demo.setCompiledKernels(false);
+            measure("update_runtime", size, [&]() { resetMotion(store); }, [&]() { demo.update(STEP); });
+            demo.setCompiledKernels(true);
+
+            measure("expiry", size, [&]() {
+                fillDemo(demo, size);
+                for (unsigned i = 0; i < store.size(); i++) {
+                    store.age[i] = 0;
+                }
+            }, [&]() { demo.update(STEP); });
+
+            measure("spawn", size, [&]() { demo.clear(); }, [&]() { demo.launch(LEAF_RULE, size); });
+        }
+
+        {
+            // A runtime rule bursting into size / BURST_PARENTS leaf fireworks.
+            FireworksDemo demo(size + BURST_PARENTS);
+            ParticleStore &parents = demo.getStore(BURST_RULE);
+            demo.getRule(BURST_RULE).setParameters(
+                    {BURST_RULE + 1, 1, 1, 0, 0, 0, 0, 0, 0, 1, 1, 1, 0xFF, 0xFF, 0xFF, LEAF_RULE, size / BURST_PARENTS});
+
+            measure("burst", size, [&]() {
+                demo.clear();
+                demo.launch(BURST_RULE, BURST_PARENTS);
+                for (unsigned i = 0; i < parents.size(); i++) {
+                    parents.age[i] = 0;
+                }
+            }, [&]() { demo.update(STEP); });
+        }
+
+        {
+            std::vector<Particle> particles(size);
+            for (Particle &particle : particles) {
+                particle.setMass(1);
+                particle.damping = 0.99f;
+                particle.acceleration = Vector3(0, -10, 0);
+            }
+
+            measure("particle", size, [&]() {
+                for (Particle &particle : particles) particle.velocity = Vector3(10, 10, 10);
+            }, [&]() {
+                for (Particle &particle : particles) particle.integrate(STEP);
+            });
+        }
+
+        {
+            std::vector<Particle> particles(size);
+            ForceRegistry registry;
+            ParticleBuoyancy buoyancy(2, 0.1f, 1);
+            ParticleGravity gravity(Vector3(0, -10, 0));
+            ParticleForceGenerator *generators[] = {&buoyancy, &gravity};
+
+            for (unsigned i = 0; i < size; i++) {
+                Particle &particle = particles[i];
+                particle.position = Vector3(0, real(i % 5), 0);
+                particle.setMass(1);
+                registry.add(&particle, &buoyancy);
+                registry.add(&particle, &gravity);
+            }
+
+            const auto clearForces = [&]() {
+                for (Particle &particle : particles) particle.clearAccumulator();
+            };
+            measure("forces", size, clearForces, [&]() { registry.updateForces(STEP); });
+            measure("forces_each", size, clearForces, [&]() {
+                for (Particle &particle : particles) {
+                    for (ParticleForceGenerator *generator : generators) {
+                        generator->updateForce(&particle, STEP);
+                    }
+                }
+            });
+        }
+    }
+
+    JobSystem jobs;
+    for (unsigned size : SIZES) {
+        const unsigned chainLength = 10;
+        std::vector<Particle> particles(size);
+        std::vector<ParticleRod> rods;
+        ParticleGround ground(0, 0.3f);
+
+        for (unsigned i = 0; i < size; i++) {
+            particles[i].setMass(1);
+            particles[i].damping = 1;
+            particles[i].acceleration = Vector3::GRAVITY;
+            ground.particles.push_back(&particles[i]);
+
+            if (i % chainLength == 0) continue;
+            ParticleRod rod;
+            rod.particle[0] = &particles[i - 1];
+            rod.particle[1] = &particles[i];
+            rod.length = 1;
+            rods.push_back(rod);
+        }
+
+        std::vector<ParticleContact> contacts(size + rods.size());
+        ParticleContactResolver resolver(20);
+        resolver.setJobSystem(&jobs);
+
+        // Chains standing on end, a bit stretched, sunk in the ground and falling.
+        measure("contacts", size, [&]() {
+            for (unsigned i = 0; i < size; i++) {
+                particles[i].position = Vector3(real(i / chainLength) * 2, real(i % chainLength) * 1.1f - 0.5f, 0);
+                particles[i].velocity = Vector3(0, -5, 0);
+            }
+        }, [&]() {
+            unsigned used = ground.addContact(contacts.data(), (unsigned) contacts.size());
+            for (const ParticleRod &rod : rods) {
+                used += rod.addContact(contacts.data() + used, (unsigned) contacts.size() - used);
+            }
+            resolver.resolveContacts(contacts.data(), used, STEP);
+        });
+    }
+
+    for (unsigned size : SIZES) {
+        if (size < 10000) continue;
+
+        const unsigned queries = 1000;
+        std::vector<real> x(size), y(size), queryX(queries), queryY(queries);
+        Random random(size);
+        random.fillReals(x.data(), size, 0, 1024);
+        random.fillReals(y.data(), size, 0, 2048);
+        random.fillReals(queryX.data(), queries, 0, 1024);
+        random.fillReals(queryY.data(), queries, 0, 2048);
+
+        SpatialGrid grid(0, 0, 1024, 2048, 32);
+        measure("grid_build", size, []() {}, [&]() { grid.build(x.data(), y.data(), size); });
+
+        // Sum the found indices into the sink, so that the queries cannot be optimised away.
+        unsigned long long found = 0;
+        measure("grid_query", size, []() {}, [&]() {
+            for (unsigned q = 0; q < queries; q++) {
+                grid.queryRadius(queryX[q], queryY[q], 32, [&found](unsigned index, real) { found += index; });
+            }
+        }, queries);
+        sink = found;
+    }
+
+    for (unsigned size : SIZES) {
+        ParticleSnapshot snapshot;
+        snapshot.resize(size);
+        Random random(size);
+        for (unsigned i = 0; i < size; i++) {
+            snapshot.x[i] = snapshot.previousX[i] = (float) random.randomReal(0, 1080);
+            snapshot.y[i] = snapshot.previousY[i] = (float) random.randomReal(0, 1920);
+            snapshot.color[i] = i % 3 == 0 ? 0xFF0000FF : i % 3 == 1 ? 0x00FF00FF : 0x0000FFFF;
+            snapshot.size[i] = 5;
+        }
+
+        ParticleRaster raster;
+        raster.resize(1080, 1920);
+        const auto clear = [&]() { raster.clear(0xFF000000); };
+
+        raster.setBlend(ParticleRaster::OVER);
+        measure("raster_over", size, clear, [&]() { raster.draw(snapshot); });
+        raster.setBlend(ParticleRaster::ADD);
+        measure("raster_add", size, clear, [&]() { raster.draw(snapshot); });
+
+        raster.setBlend(ParticleRaster::OVER);
+        raster.setJobSystem(&jobs);
+        measure("raster_jobs", size, clear, [&]() { raster.draw(snapshot); });
+    }
+
+    if (argc > 1) {
+        std::ofstream out(argv[1]);
+        out << "benchmark,particles,ns_per_particle,iterations" << std::endl;
+        for (const Result &result : results) {
+            out << result.name << "," << result.particles << "," << result.nsPerParticle << ","
+                << result.iterations << std::endl;
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,143 @@
+/**
+ * Measures the per-frame cost of drawing particles with the software renderer, for a growing
+ * number of particles, with each of the PP draw paths:
+ *  - pixel: one render_pixel (color change + fill call) per particle, the historical path,
+ *  - batch: batch_pixel + flush_batch, one fill call per color,
+ *  - geometry: batch_pixel + flush_batch_geometry, one call per frame (SDL >= 2.0.18 only),
+ *  - sprite_copy: one SDL_RenderCopy per sprite, alternating between three small textures,
+ *  - sprite_batch: the same sprites through a SpriteBatch, one call per texture,
+ *  - raster: the particles drawn on the CPU by a ParticleRaster, as solid squares, and uploaded
+ *    through one streaming texture (PP::blit_pixels).
+ *
+ * Output is CSV on stdout: mode,particles,ms_per_frame.
+ */
+#include <iostream>
+#include <vector>
+
+#include <SDL.h>
+
+#include "utils/PP.cpp"
+#include "utils/SpriteBatch.cpp"
+#include "utils/ParticleRaster.cpp"
+
+static const int WIDTH = 360;
+static const int HEIGHT = 640;
+static const int FRAMES = 30;
+
+struct Dot {
+    int x, y;
+    Uint8 r, g, b;
+};
+
+static double now_ms() {
+    return SDL_GetPerformanceCounter() * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+template<typename Draw>
+static double measure(SDL_Renderer *renderer, Draw draw) {
+    const double start = now_ms();
+    for (int frame = 0; frame < FRAMES; frame++) {
+        SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
+        SDL_RenderClear(renderer);
+        draw();
+        SDL_RenderPresent(renderer);
+    }
+    return (now_ms() - start) / FRAMES;
+}
+
+int main(int argc, char *argv[]) {
+    PP &pp = PP::getInstance();
+    if (!pp.init_software(WIDTH, HEIGHT)) {
+        return EXIT_FAILURE;
+    }
+    SDL_Renderer *renderer = pp.get_renderer();
+
+    // The same three colors as the firework rules.
+    const Uint8 palette[3][3] = {{0xFF, 0x00, 0x00}, {0x00, 0xFF, 0x00}, {0x00, 0x00, 0xFF}};
+    const int counts[] = {100, 1000, 5000, 20000, 100000};
+
+    // Three small solid textures, for the sprites.
+    SDL_Texture *textures[3];
+    for (int i = 0; i < 3; i++) {
+        SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, 8, 8, 32, SDL_PIXELFORMAT_ARGB8888);
+        SDL_FillRect(surface, nullptr, 0xFF000000u | palette[i][0] << 16 | palette[i][1] << 8 | palette[i][2]);
+        textures[i] = SDL_CreateTextureFromSurface(renderer, surface);
+        SDL_FreeSurface(surface);
+    }
+    const SDL_Rect source = {0, 0, 8, 8};
+    SpriteBatch sprites;
+
+    ParticleRaster raster;
+    raster.resize(WIDTH, HEIGHT);
+    raster.setFalloff(false);
+    phygine::ParticleSnapshot snapshot;
+
+    std::cout << "mode,particles,ms_per_frame" << std::endl;
+
+    for (int count : counts) {
+        std::vector<Dot> dots(count);
+        for (int i = 0; i < count; i++) {
+            const Uint8 *color = palette[i % 3];
+            dots[i] = {rand() % WIDTH, rand() % HEIGHT, color[0], color[1], color[2]};
+        }
+
+        const double pixel = measure(renderer, [&]() {
+            for (const Dot &d : dots)
+                pp.render_pixel(renderer, d.r, d.g, d.b, 0xFF, d.x, d.y, 5, 5);
+        });
+        std::cout << "pixel," << count << "," << pixel << std::endl;
+
+        const double batch = measure(renderer, [&]() {
+            for (const Dot &d : dots)
+                pp.batch_pixel(d.r, d.g, d.b, 0xFF, d.x, d.y, 5, 5);
+            pp.flush_batch(renderer);
+        });
+        std::cout << "batch," << count << "," << batch << std::endl;
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+        const double geometry = measure(renderer, [&]() {
+            for (const Dot &d : dots)
+                pp.batch_pixel(d.r, d.g, d.b, 0xFF, d.x, d.y, 5, 5);
+            pp.flush_batch_geometry(renderer);
+        });
+        std::cout << "geometry," << count << "," << geometry << std::endl;
+#endif
+
+        const double spriteCopy = measure(renderer, [&]() {
+            for (int i = 0; i < count; i++) {
+                const SDL_Rect destination = {dots[i].x, dots[i].y, 8, 8};
+                SDL_RenderCopy(renderer, textures[i % 3], &source, &destination);
+            }
+        });
+        std::cout << "sprite_copy," << count << "," << spriteCopy << std::endl;
+
+        const double spriteBatch = measure(renderer, [&]() {
+            for (int i = 0; i < count; i++) {
+                sprites.draw(textures[i % 3], source, {dots[i].x, dots[i].y, 8, 8});
+            }
+            sprites.flush(renderer);
+        });
+        std::cout << "sprite_batch," << count << "," << spriteBatch << std::endl;
+
+        // The same squares as render_pixel, which takes x and y from the bottom right.
+        snapshot.resize(count);
+        for (int i = 0; i < count; i++) {
+            snapshot.x[i] = snapshot.previousX[i] = (float) dots[i].x;
+            snapshot.y[i] = snapshot.previousY[i] = (float) dots[i].y;
+            snapshot.color[i] = (Uint32) dots[i].r << 24 | (Uint32) dots[i].g << 16 | (Uint32) dots[i].b << 8 | 0xFF;
+            snapshot.size[i] = 5;
+        }
+        const double rasterFrame = measure(renderer, [&]() {
+            raster.clear(0xFFFFFFFF);
+            raster.draw(snapshot);
+            pp.blit_pixels(renderer, raster.getPixels(), raster.getWidth(), raster.getHeight(), raster.getPitch());
+        });
+        std::cout << "raster," << count << "," << rasterFrame << std::endl;
+    }
+
+    for (SDL_Texture *texture : textures) {
+        SDL_DestroyTexture(texture);
+    }
+    pp.clean();
+    return EXIT_SUCCESS;
+}
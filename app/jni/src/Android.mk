@@ -9,6 +9,13 @@ LOCAL_C_INCLUDES := $(LOCAL_PATH)/../SDL/include $(LOCAL_PATH)/../SDL2_image $(L
 # Add your application source files here...
 LOCAL_SRC_FILES := loop.cpp
 
+# Simulate with fixed-point reals, giving the same results on every ABI (see phygine/precision.cpp).
+# LOCAL_CPPFLAGS += -DPHYGINE_FIXED_POINT
+
+# Count the heap allocations of each frame, and check the game loop stops allocating once warmed
+# up (see utils/AllocationTracker.cpp).
+# LOCAL_CPPFLAGS += -DTRACK_ALLOCATIONS
+
 LOCAL_SHARED_LIBRARIES := SDL2 SDL2_image
 
 LOCAL_LDLIBS := -lGLESv1_CM -lGLESv2 -llog
@@ -4,6 +4,10 @@
 #include <string>
 #include <string.h>
 
+#include "utils/AsyncLoader.cpp"
+#include "utils/SpriteBatch.cpp"
+#include "utils/TextureCache.cpp"
+
 
 class Character {
 public:
@@ -12,38 +16,84 @@ public:
     ~Character() {}
 
     void init(SDL_Renderer *renderer, std::string path, const int width, const int height) {
-        // Load the images
-
-        // The surface is only useful until SDL_CreateTextureFromSurface is called.
-        SDL_Surface *tempSurface = IMG_Load(path.c_str());
-        playerTexture = SDL_CreateTextureFromSurface(renderer, tempSurface);
-        SDL_FreeSurface(tempSurface);
+        // Load the images, or share them with the characters that already did.
+        this->texture = TextureCache::getInstance().acquire(renderer, path);
+        this->sprite.texture = this->texture.get();
+        this->sprite.source = {0, 0, this->texture.width(), this->texture.height()};
 
         // Define the player image render size.
         this->width = width;
         this->height = height;
     }
 
+    /**
+     * Load the image in the background. The character is not drawn until the image is uploaded
+     * (see AsyncLoader::update).
+     */
+    void init(AsyncLoader &loader, std::string path, const int width, const int height, int priority = 0) {
+        this->texture.release();
+        this->sprite = Sprite();
+        this->loading = loader.load(path, priority);
+
+        this->width = width;
+        this->height = height;
+    }
+
+    /** Use an image of an atlas (see TextureAtlas::find), which the atlas keeps alive. */
+    void init(const Sprite &sprite, const int width, const int height) {
+        this->texture.release();
+        this->sprite = sprite;
+
+        this->width = width;
+        this->height = height;
+    }
+
     void updatePos(const int x, const int y) {
         this->x = x;
         this->y = y;
     }
 
     void render(SDL_Renderer *renderer) {
+        if (!this->_poll()) return;
+
         SDL_Rect posRect = {this->x, this->y, this->width, this->height};
         // show the player image.
-        SDL_RenderCopy(renderer, playerTexture, nullptr, &posRect);
+        SDL_RenderCopy(renderer, this->sprite.texture, &this->sprite.source, &posRect);
+    }
+
+    /** Queue the character in a batch, to be drawn along with the others sharing its texture. */
+    void render(SpriteBatch &batch, int layer = 0) {
+        if (!this->_poll()) return;
+
+        SDL_Rect posRect = {this->x, this->y, this->width, this->height};
+        batch.draw(this->sprite, posRect, layer);
     }
 
     void clean() {
-        SDL_DestroyTexture(playerTexture);
+        this->loading.cancel();
+        this->loading = AsyncLoader::Handle();
+        this->texture.release();
+        this->sprite = Sprite();
     }
 
 private:
-    SDL_Texture *playerTexture;
+    TextureHandle texture;
+    Sprite sprite;
+    AsyncLoader::Handle loading;
 
     int width;
     int height;
     int x;
     int y;
-};
\ No newline at end of file
+
+    /** Pick the texture up once loaded. Returns whether there is one to draw. */
+    bool _poll() {
+        if (this->sprite.texture == nullptr && this->loading.ready()) {
+            this->texture = this->loading.texture();
+            this->sprite.texture = this->texture.get();
+            this->sprite.source = {0, 0, this->texture.width(), this->texture.height()};
+            this->loading = AsyncLoader::Handle();
+        }
+        return this->sprite.texture != nullptr;
+    }
+};
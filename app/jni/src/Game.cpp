@@ -4,12 +4,24 @@
 #include <stdio.h>
 #include <string>
 #include <string.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <SDL.h>
 #include <SDL_image.h>
 
 #include "Character.cpp"
 #include "utils/PP.cpp"
+#include "utils/DirtyRegions.cpp"
+#include "utils/AsyncLoader.cpp"
+#include "utils/JobSystem.cpp"
+#include "utils/ParticleRaster.cpp"
+#include "utils/TripleBuffer.cpp"
+#include "utils/InputRecording.cpp"
+#include "utils/Stats.cpp"
+#include "utils/Profiler.cpp"
 #include "phygine/Fireworks.cpp"
 
 extern const bool IS_MOBILE;
@@ -19,11 +31,39 @@ public:
     Game() = default;
     ~Game() = default;
 
-    int init(const char *title, int xpos, int ypos) {
+    int init(const char *title, int xpos, int ypos, bool vsync = false) {
         isRunning = true;
 
         PP &pp = PP::getInstance();
-        pp.init("Super game", xpos, ypos);
+        pp.init(title, xpos, ypos, vsync);
+
+        this->width = pp.get_screen_width();
+        this->height = pp.get_screen_height();
+
+        this->fireworkHandler.setJobSystem(&this->jobs);
+        this->fireworkHandler.setWorldBounds(this->width, this->height);
+        this->dirty.setScreen(this->width, this->height);
+        this->_reserve();
+
+        // One batch per firework color, each able to hold every firework.
+        pp.reserve_batch(FireworksDemo::getRuleCount(), this->fireworkHandler.getCapacity());
+
+        return EXIT_SUCCESS;
+    }
+
+    /**
+     * Initialise the game without any window nor renderer, to replay a recorded session. Only
+     * the simulation runs: render() and uploadAssets() must not be called.
+     */
+    int initHeadless(int width, int height) {
+        isRunning = true;
+
+        this->width = width;
+        this->height = height;
+
+        this->fireworkHandler.setJobSystem(&this->jobs);
+        this->fireworkHandler.setWorldBounds(this->width, this->height);
+        this->_reserve();
 
         return EXIT_SUCCESS;
     }
@@ -37,36 +77,200 @@ public:
 
         // Multiples event can have occurred since the last call. We de-pile them all with the while
         while (pp.getEvents(&event)) {
-            switch (event.type) {
-                case SDL_QUIT:
-                    isRunning = false;
-                    break;
-                case SDL_FINGERDOWN:
-                    // event.tfinger.x and y are normalized, so we have to multiple them by the screen size to get the real pos.
-                    this->c.updatePos(
-                            event.tfinger.x * this->width,
-                            event.tfinger.y * this->height);
-                    break;
-                case SDL_FINGERMOTION:
-                    this->c.updatePos(
-                            event.tfinger.x * this->width,
-                            event.tfinger.y * this->height);
-                    break;
-                case SDL_FINGERUP:
-                    break;
-                default:
-                    break;
+            if (this->recorder) this->recorder->event(event);
+            this->processEvent(event);
+        }
+        this->applyInput();
+    }
+
+    /**
+     * Handle one event, polled or replayed. Finger events only update the state of their finger:
+     * applyInput() acts on the result once all the events of the frame are handled, so a burst of
+     * motion events costs as much as the last one.
+     */
+    void processEvent(const SDL_Event &event) {
+        switch (event.type) {
+            case SDL_QUIT:
+                isRunning = false;
+                break;
+            case SDL_FINGERDOWN:
+            case SDL_FINGERMOTION: {
+                Finger *finger = this->_finger(event.tfinger.fingerId);
+                if (finger == nullptr) {
+                    this->fingers.push_back({event.tfinger.fingerId, 0, 0, false});
+                    finger = &this->fingers.back();
+                } else if (finger->moved) {
+                    this->latency.coalescedEvents++;
+                }
+                finger->x = event.tfinger.x;
+                finger->y = event.tfinger.y;
+                finger->moved = true;
+                this->_input(event.tfinger.timestamp);
+                break;
             }
+            case SDL_FINGERUP: {
+                Finger *finger = this->_finger(event.tfinger.fingerId);
+                if (finger != nullptr) {
+                    this->fingers.erase(this->fingers.begin() + (finger - this->fingers.data()));
+                }
+                this->_input(event.tfinger.timestamp);
+                break;
+            }
+            // What was drawn was lost (the app went to the background, on Android): the dirty
+            // regions mode must redraw everything.
+            case SDL_WINDOWEVENT:
+                if (event.window.event == SDL_WINDOWEVENT_EXPOSED) this->dirty.markAll();
+                break;
+            case SDL_RENDER_TARGETS_RESET:
+                this->dirty.markAll();
+                break;
+            case SDL_RENDER_DEVICE_RESET:
+                PP::getInstance().reset_textures();
+                this->dirty.markAll();
+                break;
+            default:
+                break;
+        }
+    }
+
+    /**
+     * Act on the finger events handled since the last call. The first finger still down moves
+     * the character and pushes the fireworks.
+     */
+    void applyInput() {
+        if (!this->fingersChanged) return;
+        this->fingersChanged = false;
+        for (Finger &finger : this->fingers) {
+            finger.moved = false;
+        }
+
+        if (this->fingers.empty()) {
+            this->_touch(false, 0, 0, this->inputAt);
+        } else {
+            const Finger &primary = this->fingers.front();
+            // x and y are normalized, so we have to multiple them by the screen size to get the real pos.
+            this->c.updatePos(primary.x * this->width, primary.y * this->height);
+            this->_touch(true, primary.x, primary.y, this->inputAt);
         }
+        this->inputAt = 0;
+    }
+
+    /**
+     * Record the events handled from now on into the given recorder, or stop recording with
+     * nullptr. The frames are closed by the caller, which knows their duration.
+     */
+    void setRecorder(InputRecorder *recorder) {
+        this->recorder = recorder;
+    }
+
+    /** Hash of the simulation state, to check a replay against its recording. */
+    uint64_t stateHash() const {
+        return this->fireworkHandler.stateHash();
+    }
+
+    int getWidth() const {
+        return this->width;
+    }
+
+    int getHeight() const {
+        return this->height;
+    }
+
+    /**
+     * Advance the elements of the game by one simulation step.
+     *
+     * @param step: the fixed step duration, in seconds.
+     */
+    void update(float step) {
+        const Uint64 appliedInputAt = this->_applyTouch();
+        if (this->reflectedInputAt == 0) this->reflectedInputAt = appliedInputAt;
+        this->fireworkHandler.update(step);
+        this->lastUpdateAt = SDL_GetPerformanceCounter();
+        this->latency.simulationSteps++;
+    }
+
+    /**
+     * Upload the images loaded in the background since the last frame, within the frame budget
+     * given to them.
+     */
+    void uploadAssets() {
+        this->assets.update(PP::getInstance().get_renderer(), this->uploadBudgetMs);
+    }
+
+    /** Loads the images of the game off the main thread. */
+    AsyncLoader &getAssets() {
+        return this->assets;
     }
 
     /**
-     * Update the elment of the games.
+     * Switch to the pipelined mode: the simulation runs on its own thread, one fixed step at a
+     * time, and publishes a snapshot of the fireworks after each step. Meanwhile render() draws
+     * the latest snapshot, so a frame costs max(simulation, render) instead of their sum, at the
+     * price of up to one more frame of latency.
+     *
+     * update() must not be called while the pipeline runs: only the simulation thread touches
+     * the fireworks.
      *
-     * @param lastFrameDuration: time elapsed in ms.
+     * @param step: the fixed step duration, in seconds.
+     */
+    void startPipeline(float step) {
+        if (this->pipelined()) return;
+
+        this->pipelineStep = step;
+        this->simulating = true;
+        this->simulationThread = std::thread(&Game::_simulate, this, step);
+    }
+
+    void stopPipeline() {
+        if (!this->pipelined()) return;
+
+        this->simulating = false;
+        this->simulationThread.join();
+    }
+
+    bool pipelined() const {
+        return this->simulationThread.joinable();
+    }
+
+    /**
+     * Only clear and redraw the parts of the screen that changed since the last frame (see
+     * DirtyRegions), rather than the whole screen. Saves fill rate when little moves, with the
+     * software renderer (see PP::render_dirty). Not used with setRasterParticles, which uploads
+     * whole frames.
+     */
+    void setDirtyRegions(bool enabled) {
+        this->dirtyTracking = enabled;
+        this->dirty.markAll();
+    }
+
+    /**
+     * Fireworks drawn and skipped as out of view by the last render. In dirty regions mode, each
+     * region is a pass over the fireworks, which all count.
+     */
+    const FireworksDemo::DrawStats &lastDrawStats() const {
+        return this->drawStats;
+    }
+
+    /**
+     * Make the fireworks flying off the sides or the top of the screen expire at once, without
+     * their payload (see FireworksDemo::setOffscreenExpiry). Changes the simulation, and so the
+     * replays of the sessions recorded without it.
+     */
+    void setOffscreenExpiry(bool enabled) {
+        this->fireworkHandler.setOffscreenExpiry(enabled);
+    }
+
+    /** Pixels cleared and drawn again by the last render. */
+    unsigned long long pixelsTouched() const {
+        return this->lastPixelsTouched;
+    }
+
+    /**
+     * Draw the fireworks on the CPU (see ParticleRaster), as soft discs, and upload the frame in
+     * one go, rather than with a fill call per color. Faster for dense scenes.
      */
-    void update(float lastFrameDuration) {
-        this->fireworkHandler.update(lastFrameDuration);
+    void setRasterParticles(bool raster) {
+        this->rasterParticles = raster;
     }
 
     /**
@@ -74,25 +278,416 @@ public:
     */
     void _render(SDL_Renderer* renderer) {
         // this->c.render(renderer);
-        this->fireworkHandler.display(renderer);
+        {
+            PROFILE_SUBSCOPE("fireworks");
+            if (this->rasterParticles) {
+                this->_rasterFireworks(renderer);
+            } else if (this->dirtyTracking && !this->_fireworksInRegion()) {
+                // The region being redrawn has no firework: nothing to go through.
+                this->drawStats.culled += this->liveParticles();
+            } else if (this->pipelined()) {
+                FireworksDemo::display(renderer, this->snapshots.readBuffer(), this->renderAlpha, &this->drawStats);
+            } else {
+                this->fireworkHandler.display(renderer, this->renderAlpha, &this->drawStats);
+            }
+        }
+
+        Profiler &profiler = Profiler::getInstance();
+        if (profiler.overlayEnabled && PP::getInstance().is_visible(profiler.overlayBounds())) {
+            profiler.renderOverlay(renderer);
+        }
     }
 
-    void render() {
+    /**
+     * @param alpha: how far we are between the last two simulation steps, used to interpolate
+     *  the positions of the elements. Ignored in pipelined mode, where it comes from the age of
+     *  the snapshot.
+     */
+    void render(float alpha) {
+        // Time at which the state we are about to show was produced, and the oldest input it is
+        // the first to show.
+        Uint64 producedAt = this->lastUpdateAt;
+        Uint64 inputAt = this->reflectedInputAt;
+        this->reflectedInputAt = 0;
+
+        if (this->pipelined()) {
+            this->snapshots.acquire();
+            const ParticleSnapshot &snapshot = this->snapshots.readBuffer();
+
+            // Interpolate from the previous step to the snapshot one, over one step duration.
+            const float age = (float) (SDL_GetPerformanceCounter() - snapshot.takenAt) / SDL_GetPerformanceFrequency();
+            alpha = SDL_min(age / this->pipelineStep, 1.0f);
+            producedAt = snapshot.takenAt;
+            inputAt = snapshot.inputAt > this->presentedInputAt ? snapshot.inputAt : 0;
+        }
+        this->renderAlpha = alpha;
+        this->drawStats = FireworksDemo::DrawStats();
+
         PP &pp = PP::getInstance();
-        pp.render(this, &Game::_render);
+        if (this->dirtyTracking && !this->rasterParticles) {
+            this->_markDirty();
+            this->lastPixelsTouched = pp.render_dirty(this, &Game::_render, this->dirty);
+            this->dirty.clear();
+        } else {
+            this->lastPixelsTouched = (unsigned long long) this->width * this->height;
+            pp.render(this, &Game::_render);
+        }
+
+        const Uint64 presentedAt = SDL_GetPerformanceCounter();
+        if (inputAt != 0) {
+            this->latency.addInput(presentedAt - inputAt);
+            this->presentedInputAt = inputAt;
+        }
+        this->latency.add(presentedAt - producedAt);
     }
 
     void clean() {
-        // this->c.clean();
+        this->stopPipeline();
+
+        this->c.clean();
         PP &pp = PP::getInstance();
         pp.clean();
     }
 
     bool running() { return isRunning; };
 
+    /** Number of fireworks alive, or shown by the last snapshot in pipelined mode. */
+    unsigned liveParticles() const {
+        return this->pipelined() ? this->snapshots.readBuffer().count() : this->fireworkHandler.liveCount();
+    }
+
 private:
     bool isRunning{};
+    int width{};
+    int height{};
+    float renderAlpha = 1;
+
+    Character c;
+
+    /** Where the handled events are recorded, if anywhere. */
+    InputRecorder *recorder = nullptr;
+
+    /** Image loading, and the time it may take from each frame for the uploads (in ms). */
+    AsyncLoader assets;
+    const double uploadBudgetMs = 2;
+
+    /** Spreads the simulation across the cores. */
+    JobSystem jobs;
     FireworksDemo fireworkHandler;
+
+    /**
+     * Dirty regions mode: the regions to redraw this frame, and where each drawable was drawn
+     * last frame (one rect per firework rule, or a single one from the snapshot in pipelined
+     * mode).
+     */
+    bool dirtyTracking = false;
+    DirtyRegions dirty;
+    std::vector<SDL_Rect> drawnRects;
+    unsigned long long lastPixelsTouched = 0;
+
+    /** What the last render did with the fireworks. */
+    FireworksDemo::DrawStats drawStats;
+
+    /** The CPU draw of the fireworks, and the copy of them it draws from in serial mode. */
+    bool rasterParticles = false;
+    ParticleRaster raster;
+    ParticleSnapshot rasterSnapshot;
+
+    /** Pipelined mode: the simulation thread, and the snapshots it hands over to the render. */
+    std::thread simulationThread;
+    std::atomic<bool> simulating{false};
+    TripleBuffer<ParticleSnapshot> snapshots;
+    float pipelineStep = 1;
+
+    /** A finger on the screen, at its last normalized position. */
+    struct Finger {
+        SDL_FingerID id;
+        float x;
+        float y;
+        /** Whether it moved since the last applyInput(). */
+        bool moved;
+    };
+
+    /** The fingers down, in the order they touched the screen. */
+    std::vector<Finger> fingers;
+    /** Whether a finger event was handled since the last applyInput(). */
+    bool fingersChanged = false;
+    /** When the oldest input not applied yet was made, in performance counter ticks, or 0. */
+    Uint64 inputAt = 0;
+
+    /**
+     * Where the screen is touched, in world coordinates. Written by the events and read by the
+     * simulation, which may be on another thread. inputAt is the time of the oldest input not
+     * taken into account by the simulation yet, or 0.
+     */
+    struct Touch {
+        bool down = false;
+        float x = 0;
+        float y = 0;
+        Uint64 inputAt = 0;
+    } touch;
+    std::mutex touchMutex;
+
+    /**
+     * Input to photon latency: the oldest input reflected by the last simulation step and not
+     * presented yet (serial mode), and the last input presented.
+     */
+    Uint64 reflectedInputAt = 0;
+    std::atomic<Uint64> presentedInputAt{0};
+
+    /** Most fingers tracked without allocating. */
+    const static unsigned maxFingers = 10;
+
+    /**
+     * Allocate up front the memory every mode may need with the fireworks pool full, so that
+     * the steady state game loop does not allocate (see AllocationTracker).
+     */
+    void _reserve() {
+        const unsigned capacity = this->fireworkHandler.getCapacity();
+        this->fireworkHandler.reserve();
+        this->rasterSnapshot.reserve(capacity);
+        this->snapshots.forEachBuffer([capacity](ParticleSnapshot &snapshot) {
+            snapshot.reserve(capacity);
+        });
+        this->drawnRects.assign(FireworksDemo::getRuleCount(), SDL_Rect{0, 0, 0, 0});
+        this->fingers.reserve(maxFingers);
+    }
+
+    /** Mark where the drawables were drawn last frame and where they are drawn now. */
+    void _markDirty() {
+        const unsigned rules = FireworksDemo::getRuleCount();
+        if (this->drawnRects.size() != rules) this->drawnRects.assign(rules, SDL_Rect{0, 0, 0, 0});
+
+        // In pipelined mode, the snapshot only gives one box for all of them, kept in the first
+        // rect. The others are emptied, in case the mode just changed.
+        float snapshotMinX = 0, snapshotMinY = 0, snapshotMaxX = 0, snapshotMaxY = 0;
+        unsigned snapshotSize = 0;
+        const bool fromSnapshot = this->pipelined();
+        const bool snapshotDrawn = fromSnapshot && this->snapshots.readBuffer().bounds(
+                snapshotMinX, snapshotMinY, snapshotMaxX, snapshotMaxY, snapshotSize);
+
+        for (unsigned rule = 0; rule < rules; rule++) {
+            SDL_Rect current = {0, 0, 0, 0};
+            real minX, minY, maxX, maxY;
+            if (fromSnapshot) {
+                if (rule == 0 && snapshotDrawn) {
+                    current = this->_fireworkRect(snapshotMinX, snapshotMinY, snapshotMaxX, snapshotMaxY,
+                                                  (int) snapshotSize);
+                }
+            } else if (this->fireworkHandler.bounds(rule, minX, minY, maxX, maxY)) {
+                current = this->_fireworkRect((float) minX, (float) minY, (float) maxX, (float) maxY,
+                                              FireworksDemo::displaySize);
+            }
+            this->dirty.addMove(this->drawnRects[rule], current);
+            this->drawnRects[rule] = current;
+        }
+
+        // The overlay changes every frame.
+        Profiler &profiler = Profiler::getInstance();
+        if (profiler.overlayEnabled) {
+            this->dirty.add(profiler.overlayBounds());
+        }
+    }
+
+    /**
+     * Whether any firework may be in the region render_dirty is redrawing, from where _markDirty
+     * found them this frame.
+     */
+    bool _fireworksInRegion() const {
+        const PP &pp = PP::getInstance();
+        for (const SDL_Rect &rect : this->drawnRects) {
+            if (rect.w > 0 && pp.is_visible(rect)) return true;
+        }
+        return false;
+    }
+
+    /**
+     * The screen rect covering fireworks of the given size anywhere in the given world box: they
+     * are drawn flipped, from their top left corner (see PP::to_screen).
+     */
+    SDL_Rect _fireworkRect(float minX, float minY, float maxX, float maxY, int size) const {
+        const int left = this->width - (int) maxX, top = this->height - (int) maxY;
+        const int right = this->width - (int) minX + size, bottom = this->height - (int) minY + size;
+        return {left, top, right - left, bottom - top};
+    }
+
+    void _rasterFireworks(SDL_Renderer *renderer) {
+        if (this->raster.getWidth() != this->width || this->raster.getHeight() != this->height) {
+            this->raster.resize(this->width, this->height);
+            this->raster.reserve(this->fireworkHandler.getCapacity());
+        }
+        // In pipelined mode, the job system belongs to the simulation thread.
+        this->raster.setJobSystem(this->pipelined() ? nullptr : &this->jobs);
+        // The same background as PP::render, which the frame replaces.
+        this->raster.clear(0xFFFFFFFF);
+
+        const ParticleSnapshot *snapshot = &this->rasterSnapshot;
+        if (this->pipelined()) {
+            snapshot = &this->snapshots.readBuffer();
+        } else {
+            this->fireworkHandler.snapshot(this->rasterSnapshot);
+        }
+        this->raster.draw(*snapshot, this->renderAlpha);
+        // The raster leaves out the particles off screen as it projects them.
+        this->drawStats.drawn += this->raster.getDrawnCount();
+        this->drawStats.culled += snapshot->count() - this->raster.getDrawnCount();
+
+        PP::getInstance().blit_pixels(renderer, this->raster.getPixels(), this->raster.getWidth(),
+                                      this->raster.getHeight(), this->raster.getPitch());
+    }
+
+    Finger *_finger(SDL_FingerID id) {
+        for (Finger &finger : this->fingers) {
+            if (finger.id == id) return &finger;
+        }
+        return nullptr;
+    }
+
+    /**
+     * Note a finger event made at the given SDL ticks. The time it waited in the queue is
+     * counted in its latency, to the millisecond.
+     */
+    void _input(Uint32 timestamp) {
+        this->fingersChanged = true;
+        if (this->inputAt != 0) return;
+
+        const Uint64 now = SDL_GetPerformanceCounter();
+        const Uint32 queued = SDL_GetTicks() - timestamp;
+        const Uint64 queuedTicks = (Uint64) queued * SDL_GetPerformanceFrequency() / 1000;
+        // A replayed event has an old timestamp: only count the time it could have waited.
+        this->inputAt = queued < 1000 && queuedTicks < now ? now - queuedTicks : now;
+    }
+
+    /** Radius and strength of the push of a finger on the fireworks. */
+    const float touchRadius = 120;
+    const float touchStrength = 2000;
+
+    /** Record a touch at the given normalized screen position, made at inputAt. */
+    void _touch(bool down, float x, float y, Uint64 inputAt) {
+        std::lock_guard<std::mutex> lock(this->touchMutex);
+        this->touch.down = down;
+        if (this->touch.inputAt == 0) this->touch.inputAt = inputAt;
+        // The fireworks are drawn flipped on both axes (see PP::to_screen).
+        this->touch.x = this->width - x * this->width;
+        this->touch.y = this->height - y * this->height;
+    }
+
+    /**
+     * Make the fireworks feel the last touch. Called by the simulation, before a step. Returns
+     * when the oldest input it takes into account was made, or 0 if there is no new input.
+     */
+    Uint64 _applyTouch() {
+        Touch current;
+        {
+            std::lock_guard<std::mutex> lock(this->touchMutex);
+            current = this->touch;
+            this->touch.inputAt = 0;
+        }
+
+        if (current.down) {
+            this->fireworkHandler.setRepulsor(current.x, current.y, this->touchRadius, this->touchStrength);
+        } else {
+            this->fireworkHandler.clearRepulsor();
+        }
+        return current.inputAt;
+    }
+
+    /** When the simulation state was last updated, in performance counter ticks. */
+    Uint64 lastUpdateAt = 0;
+
+    /**
+     * Accounts for the time between the production of a simulation state and the present that
+     * shows it, and for the throughput of both sides, to compare the serial and pipelined modes.
+     */
+    struct LatencyStats {
+        /** Number of frames between two reports. */
+        const static unsigned reportEvery = 300;
+
+        std::atomic<unsigned> simulationSteps{0};
+        unsigned frames = 0;
+        Uint64 sum = 0;
+        Uint64 max = 0;
+        Uint64 periodStart = 0;
+
+        /** Time from an input to the first present that shows it, in ms. */
+        RollingSamples input{256};
+        /** Motion events merged into a later one of the same frame. */
+        unsigned coalescedEvents = 0;
+
+        void addInput(Uint64 latency) {
+            input.add(latency * 1000.0 / SDL_GetPerformanceFrequency());
+        }
+
+        void add(Uint64 latency) {
+            const Uint64 now = SDL_GetPerformanceCounter();
+            if (frames == 0) periodStart = now;
+
+            frames++;
+            sum += latency;
+            if (latency > max) max = latency;
+
+            if (frames == reportEvery) {
+                const double frequency = SDL_GetPerformanceFrequency();
+                const double period = (now - periodStart) / frequency;
+
+                SDL_Log("Frames: %.1f fps, simulation: %.1f steps/s, latency: %.2f ms avg, %.2f ms max\n",
+                        frames / period, simulationSteps.exchange(0) / period,
+                        sum * 1000.0 / frequency / frames, max * 1000.0 / frequency);
+
+                if (input.count() > 0) {
+                    const Percentiles p = input.percentiles();
+                    SDL_Log("Input to photon: %.2f ms p50, %.2f ms p95, %.2f ms p99, %.2f ms max (%u inputs, %u motions coalesced)\n",
+                            p.p50, p.p95, p.p99, p.max, p.count, coalescedEvents);
+                    input.clear();
+                    coalescedEvents = 0;
+                }
+
+                frames = 0;
+                sum = max = 0;
+            }
+        }
+    } latency;
+
+    /** The loop of the simulation thread in pipelined mode. */
+    void _simulate(float step) {
+        const Uint64 frequency = SDL_GetPerformanceFrequency();
+        const Uint64 stepTicks = (Uint64) (step * frequency);
+        Uint64 nextStep = SDL_GetPerformanceCounter();
+        uint64_t stepCount = 0;
+        // The oldest input applied and not presented yet: every snapshot carries it until it is,
+        // in case the render skips some.
+        Uint64 unpresentedInputAt = 0;
+
+        while (this->simulating) {
+            {
+                PROFILE_SUBSCOPE("simulation");
+                if (unpresentedInputAt != 0 && this->presentedInputAt >= unpresentedInputAt) {
+                    unpresentedInputAt = 0;
+                }
+                const Uint64 appliedInputAt = this->_applyTouch();
+                if (unpresentedInputAt == 0) unpresentedInputAt = appliedInputAt;
+
+                this->fireworkHandler.update(step);
+                this->latency.simulationSteps++;
+
+                ParticleSnapshot &snapshot = this->snapshots.writeBuffer();
+                this->fireworkHandler.snapshot(snapshot);
+                snapshot.step = ++stepCount;
+                snapshot.takenAt = SDL_GetPerformanceCounter();
+                snapshot.inputAt = unpresentedInputAt;
+                this->snapshots.publish();
+            }
+
+            // Wait for the next step to be due. When late by more than a step, give up catching up.
+            nextStep += stepTicks;
+            const Uint64 now = SDL_GetPerformanceCounter();
+            if (nextStep > now) {
+                SDL_Delay((Uint32) ((nextStep - now) * 1000 / frequency));
+            } else if (now - nextStep > stepTicks) {
+                nextStep = now;
+            }
+        }
+    }
 };
 
 #endif // GAME_CPP
\ No newline at end of file
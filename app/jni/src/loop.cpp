@@ -1,45 +1,235 @@
 #include <iostream>
+#include <string>
+#include <string.h>
 
 #include <SDL.h>
 #include "Game.cpp"
+#include "utils/Timestep.cpp"
+#include "utils/InputRecording.cpp"
+#include "utils/FramePacer.cpp"
+#include "utils/AllocationTracker.cpp"
 
 #define SDL_MAIN_HANDLED
 
 const bool IS_MOBILE = true;
 
-static const int TARGET_FPS = 60;
-// Max time we want to have between frames (in ms).
-static const int MAX_FRAME_TIME = 1000 / TARGET_FPS;
+// Frame rate to aim for: 30, 60, 90 or 120.
+static const unsigned TARGET_FPS = 60;
+// Let the display refresh pace the frames, instead of the frame pacer.
+static const bool VSYNC = false;
+// Log the frame pacing statistics every this many frames (0 for never).
+static const unsigned PACING_REPORT_EVERY = 600;
+
+// Duration of one simulation step (in s). The simulation always advances by this amount,
+// whatever the frame rate.
+static const float SIMULATION_STEP = 1.0f / 60;
+// Max number of simulation steps run in one frame to catch up after a slow frame.
+static const unsigned MAX_STEPS_PER_FRAME = 5;
+
+// Run the simulation on its own thread, while the main thread renders the last step.
+static const bool PIPELINED = false;
+
+// Draw the fireworks on the CPU and upload them as one texture, instead of a fill call per color.
+static const bool RASTER_PARTICLES = false;
+
+// Only clear and redraw the parts of the screen that changed, instead of the whole screen. Only
+// with the software renderer (see PP::render_dirty): the others always redraw the whole screen.
+static const bool DIRTY_REGIONS = false;
+
+// Make the fireworks flying off the sides or the top of the screen expire at once, without their
+// payload. Changes the simulation, so recording turns it off: the replays run without it.
+static const bool OFFSCREEN_EXPIRY = false;
+
+// Draw the frame profile over the game, and dump it as CSV when leaving.
+static const bool PROFILE = false;
+
+// With TRACK_ALLOCATIONS defined (see Android.mk), frames after this many must not allocate on
+// the heap on the game loop thread: those that do are logged, and fail an assert in debug builds.
+// The allocations of the other threads are only logged.
+static const unsigned ALLOCATION_WARMUP_FRAMES = 300;
+
+// Record the input of the session, to replay it with --replay (see replay()). Also done with
+// --record <file> on the command line. Recording runs the serial loop, the pipelined one does not
+// replay the same.
+static const bool RECORD = false;
+// Record the state hash of each frame too, for the replay to check it gives the same simulation.
+static const bool RECORD_HASHES = false;
+// Replay this recording instead of playing, like --replay, for builds without a command line
+// (Android). A file of the recordings directory, where RECORD saves "session.rec". The hashes are
+// checked with RECORD_HASHES. nullptr to play.
+static const char *const REPLAY_PATH = nullptr;
+
+/** The path of the given file in the recordings directory, or an empty string. */
+static std::string recordingPath(const char *name) {
+    char *directory = SDL_GetPrefPath("sdl_engine", "recordings");
+    if (directory == nullptr) return std::string();
+
+    const std::string path = std::string(directory) + name;
+    SDL_free(directory);
+    return path;
+}
+
+/**
+ * Play a recorded session again without any window, as fast as possible: no rendering and no
+ * frame pacing. Reports the throughput of the simulation alone for that session. With
+ * checkHashes, stops at the first frame whose state differs from the recording.
+ */
+static int replay(const char *path, bool checkHashes) {
+    InputReplay recording;
+    if (!recording.open(path)) return EXIT_FAILURE;
+    if (checkHashes && !recording.hasHashes()) {
+        SDL_Log("%s has no state hashes to check\n", path);
+    }
+
+    Game game;
+    game.initHeadless(recording.getWidth(), recording.getHeight());
+
+    FixedTimestep timestep(SIMULATION_STEP, MAX_STEPS_PER_FRAME);
+    InputReplay::Frame frame;
+    unsigned frames = 0;
+    unsigned long long steps = 0;
+    int status = EXIT_SUCCESS;
+
+    const Uint64 start = SDL_GetPerformanceCounter();
+    while (recording.next(frame)) {
+        for (const InputRecording::Event &event : frame.events) {
+            game.processEvent(event.toSDL());
+        }
+        game.applyInput();
+        for (unsigned n = timestep.advance(frame.duration); n > 0; n--) {
+            game.update(timestep.getStep());
+            steps++;
+        }
+        frames++;
+
+        if (checkHashes && frame.hasHash && game.stateHash() != frame.hash) {
+            SDL_Log("The replay differs from the recording at frame %u\n", frames);
+            status = EXIT_FAILURE;
+            break;
+        }
+    }
+    const double seconds = (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+    SDL_Log("Replayed %u frames, %llu steps in %.3f s: %.1f frames/s, %.1f steps/s\n",
+            frames, steps, seconds, frames / seconds, steps / seconds);
+
+    game.clean();
+    return status;
+}
 
 int main(int argc, char *argv[]) {
-    Game game = Game();
+    // --record <file> [--hashes] records the session, --replay <file> [--hashes] replays one.
+    const char *recordPath = nullptr;
+    const char *replayPath = nullptr;
+    bool hashes = RECORD_HASHES;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--hashes") == 0) {
+            hashes = true;
+        }
+    }
+    if (replayPath) {
+        return replay(replayPath, hashes);
+    }
+    if (REPLAY_PATH) {
+        const std::string path = recordingPath(REPLAY_PATH);
+        return path.empty() ? EXIT_FAILURE : replay(path.c_str(), hashes);
+    }
 
-    game.init("Super game", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE );
+    Game game;
 
-    uint32_t tickStart;
-    int currentFrameTime;
+    game.init("Super game", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, VSYNC);
+
+    game.setRasterParticles(RASTER_PARTICLES);
+    game.setDirtyRegions(DIRTY_REGIONS);
+
+    InputRecorder recorder;
+    if (recordPath) {
+        recorder.open(recordPath, game.getWidth(), game.getHeight(), hashes);
+    } else if (RECORD) {
+        const std::string path = recordingPath("session.rec");
+        if (!path.empty()) {
+            recorder.open(path, game.getWidth(), game.getHeight(), hashes);
+        }
+    }
+    if (recorder.recording()) {
+        game.setRecorder(&recorder);
+    }
+
+    // Before the pipeline starts: the simulation thread then owns the fireworks.
+    game.setOffscreenExpiry(OFFSCREEN_EXPIRY && !recorder.recording());
+    if (PIPELINED && !recorder.recording()) {
+        game.startPipeline(SIMULATION_STEP);
+    }
+
+    Profiler &profiler = Profiler::getInstance();
+    profiler.overlayEnabled = PROFILE;
+    profiler.budgetMs = 1000.0 / TARGET_FPS;
+
+    FixedTimestep timestep(SIMULATION_STEP, MAX_STEPS_PER_FRAME);
+    const Uint64 counterFrequency = SDL_GetPerformanceFrequency();
+    Uint64 lastCounter = SDL_GetPerformanceCounter();
+
+    FramePacer pacer(TARGET_FPS, VSYNC);
+    pacer.setReportEvery(PACING_REPORT_EVERY);
+
+    AllocationTracker &allocations = AllocationTracker::getInstance();
+    allocations.setLoopThread();
+    unsigned frames = 0;
 
     while(game.running()) {
-        // Ticks since we've first initialized the SDL for FPS.
-        tickStart = SDL_GetTicks();
+        // Time elapsed since the last frame, in seconds.
+        const Uint64 counter = SDL_GetPerformanceCounter();
+        const float frameDuration = (float) (counter - lastCounter) / counterFrequency;
+        lastCounter = counter;
 
-        game.handleEvents();
-        game.update();
-        game.render();
+        profiler.beginFrame();
+        {
+            PROFILE_SCOPE("events");
+            game.handleEvents();
+        }
+        if (!game.pipelined()) {
+            PROFILE_SCOPE("update");
+            for (unsigned steps = timestep.advance(frameDuration); steps > 0; steps--) {
+                game.update(timestep.getStep());
+            }
+        }
+        if (recorder.recording()) {
+            recorder.endFrame(frameDuration, recorder.recordsHashes() ? game.stateHash() : 0);
+        }
+        {
+            PROFILE_SCOPE("assets");
+            game.uploadAssets();
+        }
+        game.render(timestep.alpha());
+        if (AllocationTracker::enabled() && ++frames == ALLOCATION_WARMUP_FRAMES) {
+            allocations.expectSteadyState();
+        }
+        const FireworksDemo::DrawStats &drawStats = game.lastDrawStats();
+        profiler.endFrame(game.liveParticles(), game.pixelsTouched(), allocations.endFrame(),
+                          drawStats.drawn, drawStats.culled);
 
-        // Compute how long it took to render the frame.
-        currentFrameTime = SDL_GetTicks() - tickStart;
+        // Wait for the next frame to be due.
+        pacer.wait();
+    }
 
-        // If we still have time, delay the next render.
-        if (MAX_FRAME_TIME > currentFrameTime) {
-            SDL_Delay(MAX_FRAME_TIME - currentFrameTime);
+    if (PROFILE) {
+        char *directory = SDL_GetPrefPath("sdl_engine", "profile");
+        if (directory != nullptr) {
+            profiler.dumpCsv((std::string(directory) + "frames.csv").c_str());
+            SDL_free(directory);
         }
     }
 
+    game.setRecorder(nullptr);
+    recorder.close();
     game.clean();
 
     return 0;
 }
 
 // #include <android/log.h>
-// __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", "%f", event.tfinger.x);
\ No newline at end of file
+// __android_log_print(ANDROID_LOG_ERROR, "TRACKERS", "%f", event.tfinger.x);
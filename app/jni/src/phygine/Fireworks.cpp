@@ -2,50 +2,122 @@
 #define PHYGINE_FIREWORK_H
 
 #include <stdio.h>
+#include <algorithm>
+#include <array>
+#include <utility>
+#include <vector>
+
+#ifndef PHYGINE_HEADLESS
+#include <SDL.h>
+#include "../utils/PP.cpp"
+#endif
 
 #include "precision.cpp"
 #include "Random.cpp"
-#include "Particle.cpp"
+#include "ParticleStore.cpp"
+#include "ParticleSnapshot.cpp"
+#include "SpatialGrid.cpp"
+#include "../utils/FrameArena.cpp"
+#include "../utils/JobSystem.cpp"
 
 using namespace phygine;
 
 /**
- * Fireworks are particles, with additional data for rendering and
- * evolution.
+ * A firework rule as plain constants, so that rules can be declared in
+ * constexpr tables and read at compile time. It has at most one payload.
  */
-class Firework : public Particle {
-public:
-    /** Fireworks have an integer type, used for firework rules. */
+struct FireworkRuleSpec {
     unsigned type;
+    real minAge;
+    real maxAge;
+    real minVelocityX, minVelocityY, minVelocityZ;
+    real maxVelocityX, maxVelocityY, maxVelocityZ;
+    real damping;
+    unsigned x_repartition;
+    unsigned y_repartition;
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+    /** The rule index of the payload fireworks, and how many of them (zero for none). */
+    unsigned payloadType;
+    unsigned payloadCount;
+};
 
-    /**
-     * The age of a firework determines when it detonates. Age gradually
-     * decreases, when it passes zero the firework delivers its payload.
-     * Think of age as fuse-left.
-     */
-    real age;
+/**
+ * The firework types of the demo. Each one gets its own update and spawn
+ * kernels, where these values are compile-time constants (see
+ * FireworksDemo::Kernel).
+ */
+constexpr FireworkRuleSpec fireworkRuleTable[] = {
+        // type, age range, min velocity, max velocity, damping, repartition, color, payload
+        {1, 1.5f, 1.9f, -5, 300, 1, 5, 320, 1, 0.6f, 1, 1, 0xFF, 0x00, 0x00, 1, 7},
+        {2, 0.8f, 0.9f, -50, -50, 1, 50, 50, 1, 0.2f, 50, 50, 0xFF, 0x00, 0x00, 2, 50},
+        {3, 0.5f, 0.6f, -5, -5, 1, 5, 5, 1, 0.1f, 10, 10, 0xFF, 0x00, 0x00, 0, 0},
+        {4, 0.7f, 0.75f, -40, -20, 1, 40, 20, 1, 0.2f, 40, 40, 0xFF, 0x00, 0x00, 0, 0},
+        {5, 0.5f, 1.0f, 0, 200, 1, 0, 201, 1, 0.01f, 1, 1, 0x00, 0xFF, 0x00, 0, 0},
+};
 
-    friend std::ostream &operator<<(std::ostream &os, Firework const &firework) {
-        return os << "position " << firework.position << std::endl
-                  << " velocity " << firework.velocity << std::endl
-                  << " acceleration " << firework.acceleration << std::endl
-                  << " damping " << firework.damping << " and age " << firework.age << std::endl;
-    }
+constexpr unsigned fireworkRuleTableSize = sizeof(fireworkRuleTable) / sizeof(fireworkRuleTable[0]);
 
-    /**
-     * Updates the firework by the given duration of time. Returns true
-     * if the firework has reached the end of its life and needs to be
-     * removed.
-     */
-    bool update(real duration) {
-        // Update our physical state
-        integrate(duration);
+/** The gravity of the fireworks, as Vector3::GRAVITY, but known at compile time. */
+constexpr real fireworkGravity = -9.81f;
+
+/**
+ * Fills a range of new fireworks of one type, drawing the random numbers
+ * one attribute at a time for the whole range: each loop is a plain pass
+ * over an array. The fireworks start around the parent position, spread
+ * by the repartition, or from the ground if there is no parent.
+ *
+ * @param offsets: room for 2 * count integers, used as scratch.
+ */
+inline void fillFireworks(
+        ParticleStore &store, unsigned first, unsigned count, const Vector3 *parentPosition, unsigned *offsets,
+        unsigned type, real minAge, real maxAge, const Vector3 &minVelocity, const Vector3 &maxVelocity,
+        unsigned repartition, real drag
+) {
+    Random &random = Random::r;
+
+    random.fillReals(store.age.data() + first, count, minAge, maxAge);
+
+    real *px = store.positionX.data() + first, *py = store.positionY.data() + first, *pz = store.positionZ.data() + first;
+    real *ox = store.previousX.data() + first, *oy = store.previousY.data() + first, *oz = store.previousZ.data() + first;
+    if (parentPosition) {
+        random.fillInts(offsets, 2 * count, repartition * 2);
+
+        // The position is based on the parent.
+        const real baseX = parentPosition->x - (real) repartition;
+        const real baseY = parentPosition->y - (real) repartition;
+        const real z = parentPosition->z + 1;
+        for (unsigned i = 0; i < count; i++) {
+            px[i] = ox[i] = baseX + (real) offsets[i];
+            py[i] = oy[i] = baseY + (real) offsets[count + i];
+            pz[i] = oz[i] = z;
+        }
+    } else {
+        random.fillInts(offsets, count, 200);
 
-        // We work backwards from our age to zero.
-        age -= duration;
-        return (age < 0) || (position.y < 0);
+        for (unsigned i = 0; i < count; i++) {
+            px[i] = ox[i] = (real) (offsets[i] + 20);
+            py[i] = oy[i] = 0;
+            pz[i] = oz[i] = 0;
+        }
     }
-};
+
+    // Most rules have a fixed z velocity: no need to draw it.
+    real *velocities[] = {store.velocityX.data() + first, store.velocityY.data() + first, store.velocityZ.data() + first};
+    for (unsigned axis = 0; axis < 3; axis++) {
+        if (minVelocity[axis] == maxVelocity[axis]) {
+            std::fill_n(velocities[axis], count, minVelocity[axis]);
+        } else {
+            random.fillReals(velocities[axis], count, minVelocity[axis], maxVelocity[axis]);
+        }
+    }
+
+    // We use a mass of one in all cases (no point having fireworks
+    // with different masses, since they are only under the influence
+    // of gravity).
+    store.initRange(first, count, type, 1, drag);
+}
 
 /**
  * Firework rules control the length of a firework's fuse and the
@@ -70,9 +142,12 @@ struct FireworkRule {
     /** The damping of this firework type. */
     real damping;
 
-    Uint8 r;
-    Uint8 g;
-    Uint8 b;
+    /** The drag applied at each simulation step, derived from the damping by setStep. */
+    real stepDrag;
+
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
 
     unsigned x_repartition;
     unsigned y_repartition;
@@ -95,21 +170,23 @@ struct FireworkRule {
         }
     };
 
+    /** The most payloads a firework type can have. */
+    const static unsigned maxPayloads = 4;
+
     /** The number of payloads for this firework type. */
     unsigned payloadCount;
 
-    /** The set of payloads. */
-    Payload *payloads;
+    /**
+     * The set of payloads. Held in the rule rather than on the heap:
+     * there are few, and a rule is then a plain value.
+     */
+    Payload payloads[maxPayloads];
 
-    FireworkRule() : payloadCount(0), payloads(nullptr) {}
+    FireworkRule() : damping(1), stepDrag(1), payloadCount(0) {}
 
+    /** Sets the number of payloads, up to maxPayloads. */
     void init(unsigned payloadCount) {
-        FireworkRule::payloadCount = payloadCount;
-        payloads = new Payload[payloadCount];
-    }
-
-    ~FireworkRule() {
-        delete[] payloads;
+        FireworkRule::payloadCount = payloadCount < maxPayloads ? payloadCount : maxPayloads;
     }
 
     /**
@@ -119,7 +196,7 @@ struct FireworkRule {
             unsigned type, real minAge, real maxAge,
             const Vector3 &minVelocity, const Vector3 &maxVelocity, real damping,
             const unsigned x_repartition, const unsigned y_repartition,
-            const Uint8 r, const Uint8 g, const Uint8 b
+            const uint8_t r, const uint8_t g, const uint8_t b
     ) {
         FireworkRule::type = type;
         FireworkRule::minAge = minAge;
@@ -136,215 +213,767 @@ struct FireworkRule {
         FireworkRule::b = b;
     }
 
-    /**
-     * Creates a new firework of this type and writes it into the given
-     * instance. The optional parent firework is used to base position
-     * and velocity on.
-     */
-    void create(Firework *firework, const Firework *parent = nullptr) const {
-        firework->type = type;
-        firework->age = Random::r.randomReal(minAge, maxAge);
-
-        Vector3 vel;
-        if (parent) {
-            real x = (real) Random::r.randomInt(x_repartition * 2) - x_repartition;
-            real y = (real) Random::r.randomInt(x_repartition * 2) - x_repartition;
-            // The position and velocity are based on the parent.
-            firework->position = parent->position + Vector3{x, y, 1};
-        } else {
-            Vector3 start;
-            int x = (int) Random::r.randomInt(200) + 20;
-            start.x = real(x);
-
-            start.y = 0;
-            start.z = 0;
-            firework->position = start;
-        }
+    /** Set all the rule parameters from a rule of a table. */
+    void setParameters(const FireworkRuleSpec &spec) {
+        init(spec.payloadCount > 0 ? 1 : 0);
+        setParameters(
+                spec.type, spec.minAge, spec.maxAge,
+                Vector3(spec.minVelocityX, spec.minVelocityY, spec.minVelocityZ),
+                Vector3(spec.maxVelocityX, spec.maxVelocityY, spec.maxVelocityZ),
+                spec.damping, spec.x_repartition, spec.y_repartition, spec.r, spec.g, spec.b
+        );
+        if (spec.payloadCount > 0) payloads[0].set(spec.payloadType, spec.payloadCount);
+    }
 
-        vel += Random::r.randomVector(minVelocity, maxVelocity);
-        firework->velocity = vel;
+    /** Computes the per-step constants of the rule for the given step duration. */
+    void setStep(real step) {
+        stepDrag = ParticleStore::dragForStep(damping, step);
+    }
 
-        // We use a mass of one in all cases (no point having fireworks
-        // with different masses, since they are only under the influence
-        // of gravity).
-        firework->setMass(1);
-        firework->damping = damping;
-        firework->acceleration = Vector3::GRAVITY;
-        firework->forceAccum.clear();
+    /**
+     * Creates new fireworks of this type into the given range of slots of
+     * the store. The optional parent position is used to base the
+     * position of the new fireworks on.
+     *
+     * @param offsets: room for 2 * count integers, used as scratch.
+     */
+    void create(ParticleStore &store, unsigned first, unsigned count, const Vector3 *parentPosition, unsigned *offsets) const {
+        fillFireworks(store, first, count, parentPosition, offsets,
+                      type, minAge, maxAge, minVelocity, maxVelocity, x_repartition, stepDrag);
     }
 };
 
 class FireworksDemo {
-    /** Holds the index of the next firework slot to use. */
-
-    /** Holds the maximum number of fireworks that can be in use. */
-    const static unsigned maxFireworks = 1024;
+    /** Holds the default maximum number of fireworks that can be in use. */
+    const static unsigned defaultCapacity = 1024;
 
-    /** Holds the firework data. */
-    Firework fireworks[maxFireworks];
-
-    /** Holds the index of the next firework slot to use. */
-    unsigned nextFirework;
+    /** Holds the duration of one simulation step, in seconds. */
+    real step;
 
     /** And the number of rules. */
     const static unsigned ruleCount = 9;
 
+    static_assert(fireworkRuleTableSize <= ruleCount, "The rule table does not fit in the rules");
+
     /** Holds the set of rules. */
     FireworkRule rules[ruleCount];
 
+    /**
+     * Holds the firework data, one store per rule, so that each store is
+     * a batch of fireworks of a single type. Live fireworks are packed at
+     * the front of each store. The stores grow on demand.
+     */
+    ParticleStore stores[ruleCount];
+
+    /** Holds the maximum number of fireworks alive at once, all rules together. */
+    unsigned capacity;
+
+    /** Holds the number of fireworks alive, all rules together. */
+    unsigned live;
+
+    /**
+     * Holds the number of fireworks integrated by one job. Also the size of
+     * the ranges the expired fireworks are collected by.
+     */
+    const static unsigned chunkSize = 4096;
+
+    static_assert(chunkSize % ParticleStore::BOUNDS_CHUNK == 0, "A batch must start on a chunk of the store bounds");
+
+    /** Holds the job system used to update the fireworks, if any. */
+    JobSystem *jobs;
+
+    /**
+     * Holds the data that only lives for one step: the batches, their
+     * expired fireworks and the bursts. Reset at the start of each step,
+     * so that a step does not allocate once the arena is big enough.
+     */
+    FrameArena stepArena;
+
+    /**
+     * A range of fireworks of one store, integrated by one job, and the
+     * index of those of them that expired during the step, in increasing
+     * order. The room for the expired ones is the size of the range.
+     */
+    struct Batch {
+        unsigned rule;
+        unsigned begin;
+        unsigned end;
+        unsigned *expired;
+        unsigned expiredCount;
+    };
+
+    /**
+     * Flags the expired fireworks of a batch that left the world bounds:
+     * they die without their payload, which would not be seen.
+     */
+    const static unsigned OFFSCREEN = 1u << 31;
+
+    /** Holds the batches of the current step, in the step arena. */
+    Batch *batches;
+    unsigned batchCount;
+
+    /** The payload of an expired firework, waiting to be spawned. */
+    struct Burst {
+        unsigned rule;
+        unsigned count;
+        Vector3 position;
+    };
+
+    /**
+     * Holds the payloads of the fireworks expired during the current step,
+     * in the step arena. They are spawned together at the end of the step,
+     * so the newborns are never moved around by the kills, nor integrated
+     * before the next step.
+     */
+    Burst *bursts;
+    unsigned burstCount;
+
+    /** Scratch room for fillFireworks. */
+    std::vector<unsigned> offsets;
+
+    /**
+     * Whether the rules of fireworkRuleTable run their compiled kernels,
+     * rather than the generic code driven by the rules.
+     */
+    bool compiledKernels;
+
+    /** Indexes the fireworks by position, for the repulsor. */
+    SpatialGrid grid;
+
+    /** Holds the size of the area the fireworks are usually in, see setWorldBounds. */
+    real worldWidth;
+    real worldHeight;
+
+    /**
+     * Whether the fireworks past the sides or the top of the world
+     * bounds, by more than the margin, expire at once. See
+     * setOffscreenExpiry.
+     */
+    bool offscreenExpiry;
+    real offscreenMargin;
+
+    /** Holds the number of fireworks expired by offscreenExpiry. */
+    unsigned long long offscreenExpired;
+
+    /**
+     * A point pushing the fireworks around it away, such as a finger on
+     * the screen.
+     */
+    struct Repulsor {
+        bool active = false;
+        real x = 0;
+        real y = 0;
+        real radius = 0;
+        /** The velocity change at the center, in units per second per step. */
+        real strength = 0;
+    } repulsor;
+
+    /**
+     * The update and spawn code of one rule of fireworkRuleTable. The rule
+     * parameters are compile-time constants here, so the compiler folds
+     * the gravity, the ranges and the payload counts into each kernel.
+     * Only the drag, which depends on the step, is given at runtime, once
+     * per batch.
+     */
+    template<unsigned Rule>
+    struct Kernel {
+        static_assert(Rule < fireworkRuleTableSize, "Unknown firework rule");
+        static_assert(fireworkRuleTable[Rule].payloadCount == 0 || fireworkRuleTable[Rule].payloadType < fireworkRuleTableSize,
+                      "The payload of a compiled rule must be a compiled rule");
+
+        /**
+         * Creates the given number of fireworks of this rule, as
+         * FireworkRule::create does. Returns how many were created, which is
+         * less than asked if the pool got full.
+         */
+        static unsigned spawn(FireworksDemo &demo, unsigned count, const Vector3 *parentPosition) {
+            constexpr FireworkRuleSpec spec = fireworkRuleTable[Rule];
+
+            const unsigned first = demo._spawn(Rule, count);
+            if (count == 0) return 0;
+
+            fillFireworks(demo.stores[Rule], first, count, parentPosition, demo._offsets(count),
+                          spec.type, spec.minAge, spec.maxAge,
+                          Vector3(spec.minVelocityX, spec.minVelocityY, spec.minVelocityZ),
+                          Vector3(spec.maxVelocityX, spec.maxVelocityY, spec.maxVelocityZ),
+                          spec.x_repartition, demo.rules[Rule].stepDrag);
+            return count;
+        }
+
+        static void integrate(FireworksDemo &demo, unsigned begin, unsigned end) {
+            demo.stores[Rule].integrateUniform(begin, end, demo.step, 0, fireworkGravity, 0, demo.rules[Rule].stepDrag);
+        }
+
+        /**
+         * Kills the given fireworks, from the last, and queues their payload
+         * to be spawned once every expired firework is gone.
+         */
+        static void expire(FireworksDemo &demo, const unsigned *expired, unsigned count) {
+            constexpr FireworkRuleSpec spec = fireworkRuleTable[Rule];
+            ParticleStore &store = demo.stores[Rule];
+
+            for (unsigned e = count; e-- > 0;) {
+                const unsigned i = expired[e] & ~OFFSCREEN;
+                if (expired[e] & OFFSCREEN) {
+                    demo.offscreenExpired++;
+                } else if (spec.payloadCount > 0) {
+                    demo.bursts[demo.burstCount++] = {spec.payloadType, spec.payloadCount, store.getPosition(i)};
+                }
+                demo._kill(Rule, i);
+            }
+        }
+    };
+
+    /** The kernels of a rule, to pick them at runtime. */
+    struct KernelFunctions {
+        unsigned (*spawn)(FireworksDemo &, unsigned, const Vector3 *);
+        void (*integrate)(FireworksDemo &, unsigned, unsigned);
+        void (*expire)(FireworksDemo &, const unsigned *, unsigned);
+    };
+
+    /** Holds the kernels of every rule of fireworkRuleTable, by rule index. */
+    std::array<KernelFunctions, fireworkRuleTableSize> kernels;
+
 private:
-    /** Creates the rules. */
+    template<size_t... Rules>
+    static std::array<KernelFunctions, sizeof...(Rules)> _makeKernels(std::index_sequence<Rules...>) {
+        return {{{&Kernel<Rules>::spawn, &Kernel<Rules>::integrate, &Kernel<Rules>::expire}...}};
+    }
+
+    /** Creates the rules, from the rule table. */
     void _initFireworkRules() {
-        // Go through the firework types and _create their rules.
-        rules[0].init(1);
-        rules[0].setParameters(
-                1, // type
-                1.5f, 1.9f, // age range
-                Vector3(-5, 300, 1), // min velocity
-                Vector3(5, 320, 1), // max velocity
-                0.6, // damping
-                1, 1, // repartition of particules
-                0xFF, 0x00, 0x00 // Colors
-        );
-        rules[0].payloads[0].set(1, 7);
-
-        rules[1].init(1);
-        rules[1].setParameters(
-                2, // type
-                0.8f, 0.9f, // age range
-                Vector3(-50, -50, 1), // min velocity
-                Vector3(50, 50, 1), // max velocity
-                0.2, // damping
-                50, 50, // repartition of particules
-                0xFF, 0x00, 0x00 // Colors
-        );
-        rules[1].payloads[0].set(2, 50);
-
-        rules[2].init(0);
-        rules[2].setParameters(
-                3, // type
-                0.5f, 0.6f, // age range
-                Vector3(-5, -5, 1), // min velocity
-                Vector3(5, 5, 1), // max velocity
-                0.1, // damping
-                10, 10, // repartition of particules
-                0xFF, 0x00, 0x00 // Colors
-        );
+        for (unsigned i = 0; i < fireworkRuleTableSize; i++) {
+            rules[i].setParameters(fireworkRuleTable[i]);
+        }
+    }
 
-        rules[3].init(0);
-        rules[3].setParameters(
-                4, // type
-                0.7f, 0.75f, // age range
-                Vector3(-40, -20, 1), // min velocity
-                Vector3(40, 20, 1), // max velocity
-                0.2, // damping
-                40, 40, // repartition of particules
-                0xFF, 0x00, 0x00 // Colors
-        );
+    /** Whether the given rule runs its compiled kernels. */
+    bool _compiled(unsigned rule) const {
+        return compiledKernels && rule < fireworkRuleTableSize;
+    }
 
-        rules[4].init(0);
-        rules[4].setParameters(
-                5, // type
-                0.5f, 1.0f, // age range
-                Vector3(0, 200, 1), // min velocity
-                Vector3(0, 201, 1), // max velocity
-                0.01, // damping
-                1, 1, // repartition of particules
-                0x00, 0xFF, 0x00 // Colors
-        );
+    /**
+     * Takes the given number of free slots at once in the store of the
+     * given rule, growing it if needed, and returns the first. The count
+     * is lowered to what the pool has room for, down to zero if it is full.
+     */
+    unsigned _spawn(unsigned rule, unsigned &count) {
+        if (count > capacity - live) count = capacity - live;
+
+        ParticleStore &store = stores[rule];
+        if (store.available() < count) {
+            unsigned grown = store.capacity() < 32 ? 64 : store.capacity() * 2;
+            if (grown < store.size() + count) grown = store.size() + count;
+            store.setCapacity(grown < capacity ? grown : capacity);
+        }
+        live += count;
+        return store.spawn(count);
+    }
+
+    void _kill(unsigned rule, unsigned i) {
+        stores[rule].kill(i);
+        live--;
+    }
+
+    /** Gets room for fillFireworks to create the given number of fireworks. */
+    unsigned *_offsets(unsigned count) {
+        if (offsets.size() < 2 * count) offsets.resize(2 * count);
+        return offsets.data();
+    }
+
+    /**
+     * Dispatches the given number of fireworks of the given rule from the
+     * given parent, all at once. Returns how many were actually created,
+     * which is less than asked if the pool got full.
+     */
+    unsigned _create(unsigned rule, unsigned count, const Vector3 *parentPosition) {
+        if (_compiled(rule)) return kernels[rule].spawn(*this, count, parentPosition);
+
+        const unsigned first = _spawn(rule, count);
+        if (count == 0) return 0;
+
+        rules[rule].create(stores[rule], first, count, parentPosition, _offsets(count));
+        return count;
     }
 
-    /** Dispatches a firework from the origin. */
-    void _create(unsigned type, const Firework *parent) {
-        // Get the rule needed to _create this firework
-        FireworkRule *rule = rules + type;
+    /** Integrates a batch, and collects its expired fireworks. */
+    void _integrate(unsigned batch) {
+        Batch &range = batches[batch];
+        ParticleStore &store = stores[range.rule];
 
-        // Create the firework
-        rule->create(fireworks + nextFirework, parent);
+        if (_compiled(range.rule)) {
+            kernels[range.rule].integrate(*this, range.begin, range.end);
+        } else {
+            store.integrate(range.begin, range.end, step);
+        }
+
+        // While the positions are in cache.
+        store.updateChunkBounds(range.begin, range.end);
+
+        unsigned expired = 0;
+        if (offscreenExpiry) {
+            // Those below the ground already expire, with their payload.
+            const real left = -offscreenMargin, right = worldWidth + offscreenMargin;
+            const real top = worldHeight + offscreenMargin;
+            for (unsigned i = range.begin; i < range.end; i++) {
+                if (store.positionX[i] < left || store.positionX[i] > right || store.positionY[i] > top) {
+                    range.expired[expired++] = i | OFFSCREEN;
+                } else if (store.age[i] < 0 || store.positionY[i] < 0) {
+                    range.expired[expired++] = i;
+                }
+            }
+        } else {
+            for (unsigned i = range.begin; i < range.end; i++) {
+                if (store.age[i] < 0 || store.positionY[i] < 0) {
+                    range.expired[expired++] = i;
+                }
+            }
+        }
+        range.expiredCount = expired;
+    }
+
+    /** Kills the expired fireworks of a batch and spawns their payloads. */
+    void _expire(unsigned batch) {
+        const Batch &range = batches[batch];
+        const unsigned rule = range.rule;
+
+        if (_compiled(rule)) {
+            kernels[rule].expire(*this, range.expired, range.expiredCount);
+            return;
+        }
+
+        const FireworkRule &fireworkRule = rules[rule];
+        for (unsigned e = range.expiredCount; e-- > 0;) {
+            const unsigned i = range.expired[e] & ~OFFSCREEN;
+            if (range.expired[e] & OFFSCREEN) {
+                offscreenExpired++;
+                _kill(rule, i);
+                continue;
+            }
 
-        // Increment the index for the next firework
-        nextFirework = (nextFirework + 1) % maxFireworks;
+            const Vector3 position = stores[rule].getPosition(i);
+            for (unsigned p = 0; p < fireworkRule.payloadCount; p++) {
+                const FireworkRule::Payload &payload = fireworkRule.payloads[p];
+                bursts[burstCount++] = {payload.type, payload.count, position};
+            }
+            _kill(rule, i);
+        }
     }
 
-    /** Dispatches the given number of fireworks from the given parent. */
-    void _create(unsigned type, unsigned number, const Firework *parent) {
-        for (unsigned i = 0; i < number; i++) {
-            _create(type, parent);
+    /** Applies the repulsor to the fireworks around it. */
+    void _repel() {
+        const real impulse = repulsor.strength * step;
+        const real inverseRadius = 1 / repulsor.radius;
+
+        for (ParticleStore &store : stores) {
+            if (store.size() == 0) continue;
+            grid.build(store);
+
+            grid.queryRadius(repulsor.x, repulsor.y, repulsor.radius, [&](unsigned i, real squareDistance) {
+                if (squareDistance <= 0) return;
+
+                const real distance = real_sqrt(squareDistance);
+                const real scale = impulse * (1 - distance * inverseRadius) / distance;
+                store.velocityX[i] += (store.positionX[i] - repulsor.x) * scale;
+                store.velocityY[i] += (store.positionY[i] - repulsor.y) * scale;
+            });
         }
     }
 
 public:
-    /** Creates a new demo object. */
-    FireworksDemo() : nextFirework(0) {
-        // Make all shots unused
-        for (Firework *firework = fireworks; firework < fireworks + maxFireworks; firework++) {
-            firework->type = 0;
+    /** Holds the size of a firework on screen, in pixels. */
+    const static int displaySize = 5;
+
+    /** Creates a new demo object, able to hold the given number of fireworks. */
+    explicit FireworksDemo(unsigned capacity = defaultCapacity)
+            : step(0), capacity(capacity), live(0), jobs(nullptr), batches(nullptr), batchCount(0),
+              bursts(nullptr), burstCount(0), compiledKernels(true),
+              grid(0, 0, 1024, 2048, 32), worldWidth(1024), worldHeight(2048),
+              offscreenExpiry(false), offscreenMargin(0), offscreenExpired(0), kernels(_makeKernels(std::make_index_sequence<fireworkRuleTableSize>())) {
+        // Fireworks are only under the influence of gravity.
+        for (ParticleStore &store : stores) {
+            store.acceleration = Vector3::GRAVITY;
         }
 
         // Create the firework types
         _initFireworkRules();
+        setTimestep(1.0f / 60);
     }
 
     ~FireworksDemo() = default;
 
-    /** Update the particle positions. */
-    void update(float lastFrameDuration) {
-        if (lastFrameDuration <= 0.0f) return;
-
-        for (Firework *firework = fireworks; firework < fireworks + maxFireworks; firework++) {
-            // Check if we need to process this firework.
-            if (firework->type > 0) {
-                // Does it need removing?
-                if (firework->update(lastFrameDuration)) {
-                    // Find the appropriate rule
-                    FireworkRule *rule = rules + (firework->type - 1);
-
-                    // Delete the current firework (this doesn't affect its
-                    // position and velocity for passing to the _create function,
-                    // just whether or not it is processed for rendering or
-                    // physics.
-                    firework->type = 0;
-
-                    // Add the payload
-                    for (unsigned i = 0; i < rule->payloadCount; i++) {
-                        FireworkRule::Payload *payload = rule->payloads + i;
-                        _create(payload->type, payload->count, firework);
-                    }
+    /**
+     * Sets the duration of the simulation steps, and computes the per-step
+     * constants of the rules and of the live fireworks once for all.
+     */
+    void setTimestep(real step) {
+        this->step = step;
+
+        for (unsigned rule = 0; rule < ruleCount; rule++) {
+            rules[rule].setStep(step);
+
+            ParticleStore &store = stores[rule];
+            for (unsigned i = 0; i < store.size(); i++) {
+                store.drag[i] = rules[rule].stepDrag;
+            }
+        }
+    }
+
+    /**
+     * Sets the job system used to spread the update across cores. With
+     * none, the update runs on the calling thread.
+     */
+    void setJobSystem(JobSystem *jobs) {
+        this->jobs = jobs;
+    }
+
+    /**
+     * Sets whether the rules of fireworkRuleTable run their compiled
+     * kernels (the default), or the generic code driven by the rules like
+     * the other ones. Changes made to those rules through getRule are
+     * only seen by the generic code.
+     */
+    void setCompiledKernels(bool enabled) {
+        compiledKernels = enabled;
+    }
+
+    /**
+     * Gives access to a rule, to set up the rules loaded at runtime,
+     * beyond the ones of fireworkRuleTable.
+     */
+    FireworkRule &getRule(unsigned ruleIndex) {
+        return rules[ruleIndex];
+    }
+
+    /**
+     * Sets the area the fireworks are usually in, to size the grid used
+     * by the repulsor. Fireworks out of it still work, only slower.
+     */
+    void setWorldBounds(real width, real height) {
+        worldWidth = width;
+        worldHeight = height;
+        grid.setBounds(0, 0, width, height, 32);
+    }
+
+    /**
+     * Sets whether the fireworks flying past the left or right side, or the
+     * top, of the world bounds, by more than the given margin, expire at
+     * once, without their payload. Nothing pulls them back sideways, and
+     * gravity is too weak against the launch speeds to bring them back
+     * down before their fuse is over, so they would only cost updates.
+     * The margin keeps those whose payload may still fly back into view.
+     *
+     * Off by default: it changes the simulation.
+     */
+    void setOffscreenExpiry(bool enabled, real margin = 64) {
+        offscreenExpiry = enabled;
+        offscreenMargin = margin;
+    }
+
+    /** Gets the number of fireworks expired for leaving the world bounds. */
+    unsigned long long getOffscreenExpired() const {
+        return offscreenExpired;
+    }
+
+    /**
+     * Pushes away the fireworks within the given radius of (x, y), at
+     * every step until clearRepulsor is called. The push fades from the
+     * given strength at the center to nothing at the radius.
+     */
+    void setRepulsor(real x, real y, real radius, real strength) {
+        repulsor.active = true;
+        repulsor.x = x;
+        repulsor.y = y;
+        repulsor.radius = radius;
+        repulsor.strength = strength;
+    }
+
+    void clearRepulsor() {
+        repulsor.active = false;
+    }
+
+    /**
+     * Update the particle positions by one simulation step.
+     *
+     * @param duration: the step duration in seconds. It is expected to be
+     *  the same every time, changing it recomputes the per-step constants.
+     */
+    void update(real duration) {
+        if (duration <= 0.0f) return;
+        if (duration != step) setTimestep(duration);
+
+        stepArena.reset();
+
+        // Cut every store into batches of fireworks of the same rule. Each
+        // batch gets its slice of a single array for its expired fireworks.
+        batchCount = 0;
+        for (const ParticleStore &store : stores) {
+            batchCount += (store.size() + chunkSize - 1) / chunkSize;
+        }
+        batches = stepArena.allocate<Batch>(batchCount);
+        unsigned *expired = stepArena.allocate<unsigned>(live);
+
+        unsigned next = 0;
+        for (unsigned rule = 0; rule < ruleCount; rule++) {
+            const unsigned count = stores[rule].size();
+            for (unsigned begin = 0; begin < count; begin += chunkSize) {
+                const unsigned end = count - begin < chunkSize ? count : begin + chunkSize;
+                batches[next++] = {rule, begin, end, expired, 0};
+                expired += end - begin;
+            }
+        }
+
+        // First pass, in parallel: integrate every live firework and collect
+        // the expired ones. Each batch only writes its own slice of the
+        // arrays and its own expiry list.
+        if (jobs) {
+            jobs->parallelFor(0, batchCount, 1, [this](unsigned begin, unsigned end) {
+                for (unsigned batch = begin; batch < end; batch++) {
+                    _integrate(batch);
                 }
+            });
+        } else {
+            for (unsigned batch = 0; batch < batchCount; batch++) {
+                _integrate(batch);
+            }
+        }
+
+        // Second pass, serial: kill the expired fireworks and queue their
+        // payloads. The batch lists are merged in order, whatever the
+        // thread that filled them, so the result is deterministic.
+        // Walk backwards, so that killing a firework only moves a live one
+        // into its slot.
+        unsigned expiredTotal = 0;
+        for (unsigned b = 0; b < batchCount; b++) {
+            expiredTotal += batches[b].expiredCount;
+        }
+        bursts = stepArena.allocate<Burst>(expiredTotal * FireworkRule::maxPayloads);
+        burstCount = 0;
+        for (unsigned b = batchCount; b-- > 0;) {
+            _expire(b);
+        }
+
+        // Last, spawn the payloads, one burst at a time. They are appended
+        // after the live fireworks, and first integrated at the next step.
+        for (unsigned b = 0; b < burstCount; b++) {
+            _create(bursts[b].rule, bursts[b].count, &bursts[b].position);
+        }
+
+        if (repulsor.active) _repel();
+    }
+
+    /**
+     * Allocates up front what the fireworks may ever need, up to the
+     * capacity, so that the updates never allocate: every store gets room
+     * for the whole capacity, as do the grid, the scratch room and the
+     * step arena. Otherwise, they grow on demand, which allocates until
+     * the busiest moments have been seen once.
+     */
+    void reserve() {
+        for (ParticleStore &store : stores) {
+            if (store.capacity() < capacity) store.setCapacity(capacity);
+        }
+        if (offsets.size() < 2 * capacity) offsets.resize(2 * capacity);
+        grid.reserve(capacity);
+
+        // The batches, their expired fireworks, and up to maxPayloads bursts
+        // per expired firework, plus the alignment padding between them.
+        const unsigned maxBatches = ruleCount + capacity / chunkSize;
+        stepArena.reserve(maxBatches * sizeof(Batch) + capacity * sizeof(unsigned) +
+                          capacity * FireworkRule::maxPayloads * sizeof(Burst) + 3 * alignof(max_align_t));
+    }
+
+    /** Gets the most fireworks that can be alive at once. */
+    unsigned getCapacity() const {
+        return capacity;
+    }
+
+    /** Gets the number of fireworks currently alive. */
+    unsigned liveCount() const {
+        return live;
+    }
+
+    /**
+     * Launches the given number of fireworks of the given rule from the
+     * ground. Returns how many were created, which is less than asked if
+     * the pool got full.
+     */
+    unsigned launch(unsigned ruleIndex, unsigned count = 1) {
+        if (ruleIndex >= ruleCount) return 0;
+        return _create(ruleIndex, count, nullptr);
+    }
+
+    /** Removes every firework. */
+    void clear() {
+        for (ParticleStore &store : stores) {
+            store.clear();
+        }
+        live = 0;
+    }
+
+    /**
+     * Gives access to the data of the fireworks of the given rule, for
+     * tools and benchmarks.
+     */
+    ParticleStore &getStore(unsigned ruleIndex) {
+        return stores[ruleIndex];
+    }
+
+    /** Gets the number of rules, and of stores. */
+    static unsigned getRuleCount() {
+        return ruleCount;
+    }
+
+    /**
+     * Gets the box around the fireworks of a rule, where display() may
+     * draw them, less their size. Returns false if there are none.
+     */
+    bool bounds(unsigned ruleIndex, real &minX, real &minY, real &maxX, real &maxY) const {
+        return stores[ruleIndex].bounds(minX, minY, maxX, maxY);
+    }
+
+    /**
+     * Hashes the state of every live firework, to check that two runs of
+     * the same input give the same simulation.
+     */
+    uint64_t stateHash() const {
+        uint64_t hash = 14695981039346656037ull;
+        for (const ParticleStore &store : stores) {
+            hash = store.hash(hash);
+        }
+        return hash;
+    }
+
+    /**
+     * Copies what is needed to display the live fireworks into the given
+     * snapshot, so they can be displayed while the simulation goes on.
+     */
+    void snapshot(ParticleSnapshot &snapshot) const {
+        const static uint8_t size = displaySize;
+
+        snapshot.resize(live);
+        unsigned out = 0;
+        for (unsigned rule = 0; rule < ruleCount; rule++) {
+            const ParticleStore &store = stores[rule];
+            const FireworkRule &fireworkRule = rules[rule];
+            const uint32_t color = (uint32_t) fireworkRule.r << 24 | (uint32_t) fireworkRule.g << 16 |
+                                   (uint32_t) fireworkRule.b << 8 | 0xFF;
+
+            for (unsigned i = 0; i < store.size(); i++, out++) {
+                snapshot.x[out] = (float) store.positionX[i];
+                snapshot.y[out] = (float) store.positionY[i];
+                snapshot.previousX[out] = (float) store.previousX[i];
+                snapshot.previousY[out] = (float) store.previousY[i];
+                snapshot.color[out] = color;
+                snapshot.size[out] = size;
             }
         }
     }
 
-    /** Display the particle positions. */
-    void display(SDL_Renderer *renderer) {
-        const static int size = 5;
+    /**
+     * Counts what the displays did with the fireworks: drawn, or skipped
+     * because they could not be seen, alone or with their whole chunk.
+     */
+    struct DrawStats {
+        unsigned drawn = 0;
+        unsigned culled = 0;
+        unsigned culledChunks = 0;
+
+        void add(const DrawStats &other) {
+            drawn += other.drawn;
+            culled += other.culled;
+            culledChunks += other.culledChunks;
+        }
+    };
 
-        for (Firework *firework = fireworks; firework < fireworks + maxFireworks; firework++) {
-            // Check if we need to process this firework.
-            if (firework->type > 0) {
-                PP &pp = PP::getInstance();
+#ifndef PHYGINE_HEADLESS
+    /**
+     * Display the particle positions. The chunks of fireworks whose box
+     * is out of view are skipped at once (see ParticleStore::chunkBounds),
+     * then each firework out of view is.
+     *
+     * @param alpha: how far the render time is between the last two
+     *  simulation steps, see FixedTimestep::alpha.
+     * @param stats: where to add what was drawn and culled, if anywhere.
+     */
+    void display(SDL_Renderer *renderer, real alpha = 1, DrawStats *stats = nullptr) {
+        const static int size = displaySize;
+        PP &pp = PP::getInstance();
+        DrawStats counts;
+
+        for (unsigned rule = 0; rule < ruleCount; rule++) {
+            const ParticleStore &store = stores[rule];
+            const FireworkRule &fireworkRule = rules[rule];
+
+            for (unsigned chunk = 0; chunk < store.chunkCount(); chunk++) {
+                const unsigned begin = chunk * ParticleStore::BOUNDS_CHUNK;
+                const unsigned end = std::min(begin + ParticleStore::BOUNDS_CHUNK, store.size());
+
+                // The box holds every interpolated position. Truncated like them, then flipped.
+                const ParticleStore::Bounds &box = store.chunkBounds[chunk];
+                const SDL_Rect area = pp.to_screen(static_cast<int>(box.maxX), static_cast<int>(box.maxY),
+                                                   static_cast<int>(box.maxX) - static_cast<int>(box.minX) + size,
+                                                   static_cast<int>(box.maxY) - static_cast<int>(box.minY) + size);
+                if (!pp.is_visible(area)) {
+                    counts.culled += end - begin;
+                    counts.culledChunks++;
+                    continue;
+                }
 
-                const Vector3 &pos = firework->position;
-                FireworkRule *rule = rules + (firework->type - 1);
+                for (unsigned i = begin; i < end; i++) {
+                    const Vector3 position = store.getInterpolatedPosition(i, alpha);
 
-                pp.render_pixel(
-                        renderer,
-                        rule->r, rule->g, rule->b, 0xFF,
-                        static_cast<int>(pos.x), static_cast<int>(pos.y), size, size
-                );
+                    const bool drawn = pp.batch_pixel(
+                            fireworkRule.r, fireworkRule.g, fireworkRule.b, 0xFF,
+                            static_cast<int>(position.x), static_cast<int>(position.y), size, size
+                    );
+                    counts.drawn += drawn;
+                    counts.culled += !drawn;
+                }
             }
         }
+
+        // Submit all the fireworks at once, one call per color.
+        pp.flush_batch(renderer);
+        if (stats) stats->add(counts);
     }
 
-    /** Handle a keypress. */
-    void key(SDL_Scancode key) {
+    /**
+     * Display the particle positions of a snapshot, skipping those out of
+     * view. A snapshot has no chunk bounds: each one is checked.
+     */
+    static void display(SDL_Renderer *renderer, const ParticleSnapshot &snapshot, float alpha = 1,
+                        DrawStats *stats = nullptr) {
+        PP &pp = PP::getInstance();
+        DrawStats counts;
+
+        for (unsigned i = 0; i < snapshot.count(); i++) {
+            const float x = snapshot.previousX[i] + (snapshot.x[i] - snapshot.previousX[i]) * alpha;
+            const float y = snapshot.previousY[i] + (snapshot.y[i] - snapshot.previousY[i]) * alpha;
+            const uint32_t color = snapshot.color[i];
+
+            const bool drawn = pp.batch_pixel(
+                    color >> 24, color >> 16, color >> 8, color,
+                    static_cast<int>(x), static_cast<int>(y), snapshot.size[i], snapshot.size[i]
+            );
+            counts.drawn += drawn;
+            counts.culled += !drawn;
+        }
+
+        pp.flush_batch(renderer);
+        if (stats) stats->add(counts);
+    }
+
+    /**
+     * Handle a keypress. Returns the number of fireworks launched, which
+     * is zero when the pool is full.
+     */
+    unsigned key(SDL_Scancode key) {
         switch (key) {
             case SDL_SCANCODE_KP_1:
-                _create(0, 1, nullptr);
-                break;
+                return launch(0);
             case SDL_SCANCODE_KP_2:
-                _create(1, 1, nullptr);
-                break;
+                return launch(1);
 //            case '3':
 //                _create(3, 1, nullptr);
 //                break;
@@ -367,7 +996,9 @@ public:
 //                _create(9, 1, nullptr);
 //                break;
         }
+        return 0;
     }
+#endif // PHYGINE_HEADLESS
 };
 
 #endif // PHYGINE_FIREWORK_H
\ No newline at end of file
@@ -0,0 +1,193 @@
+#ifndef PHYGINE_FIXED
+#define PHYGINE_FIXED
+
+#include <stdint.h>
+#include <iostream>
+#include <type_traits>
+
+namespace phygine {
+    /**
+     * A Q16.16 fixed-point number: a 32 bits integer counting 1/65536th.
+     *
+     * Every operation is integer arithmetic, so the results are the same
+     * bit for bit on every ABI, whatever the compiler and the FPU, which
+     * floats do not promise. This is what lockstep and replays need. See
+     * PHYGINE_FIXED_POINT in precision.cpp.
+     *
+     * The range is [-32768, 32768), with a resolution of 1.5e-5. Results
+     * out of the range wrap around, they do not saturate: squared
+     * distances of more than 181 units overflow.
+     *
+     * Conversions from numbers are implicit, so that constants and mixed
+     * expressions read as with floats. Conversions back are explicit.
+     */
+    class Fixed {
+    public:
+        static const int FRACTION_BITS = 16;
+        static const int32_t ONE = 1 << FRACTION_BITS;
+
+        constexpr Fixed() : raw(0) {}
+
+        template<typename Integer, typename std::enable_if<std::is_integral<Integer>::value, int>::type = 0>
+        constexpr Fixed(Integer value) : raw((int32_t) ((int64_t) value * ONE)) {}
+
+        /** Rounds to the nearest. Exact for floats with few enough fraction bits. */
+        constexpr Fixed(float value) : raw((int32_t) (value * ONE + (value < 0 ? -0.5f : 0.5f))) {}
+
+        constexpr Fixed(double value) : raw((int32_t) (value * ONE + (value < 0 ? -0.5 : 0.5))) {}
+
+        static constexpr Fixed fromRaw(int32_t raw) {
+            return Fixed(raw, RawTag());
+        }
+
+        static constexpr Fixed max() {
+            return fromRaw(INT32_MAX);
+        }
+
+        constexpr int32_t getRaw() const {
+            return raw;
+        }
+
+        explicit constexpr operator float() const {
+            return (float) raw * (1.0f / ONE);
+        }
+
+        explicit constexpr operator double() const {
+            return (double) raw * (1.0 / ONE);
+        }
+
+        /** Rounds toward negative infinity. */
+        explicit constexpr operator int() const {
+            return raw >> FRACTION_BITS;
+        }
+
+        explicit constexpr operator unsigned() const {
+            return (unsigned) (raw >> FRACTION_BITS);
+        }
+
+        constexpr Fixed operator-() const {
+            return fromRaw((int32_t) (0u - (uint32_t) raw));
+        }
+
+        // Additions go through unsigned integers, to wrap around instead of overflowing.
+        friend constexpr Fixed operator+(Fixed a, Fixed b) {
+            return fromRaw((int32_t) ((uint32_t) a.raw + (uint32_t) b.raw));
+        }
+
+        friend constexpr Fixed operator-(Fixed a, Fixed b) {
+            return fromRaw((int32_t) ((uint32_t) a.raw - (uint32_t) b.raw));
+        }
+
+        /** Rounds toward negative infinity. */
+        friend constexpr Fixed operator*(Fixed a, Fixed b) {
+            return fromRaw((int32_t) (((int64_t) a.raw * b.raw) >> FRACTION_BITS));
+        }
+
+        /** Rounds toward zero. Dividing by zero gives the highest or lowest value. */
+        friend constexpr Fixed operator/(Fixed a, Fixed b) {
+            return b.raw == 0 ? fromRaw(a.raw < 0 ? INT32_MIN : INT32_MAX)
+                              : fromRaw((int32_t) ((int64_t) a.raw * ONE / b.raw));
+        }
+
+        Fixed &operator+=(Fixed b) { return *this = *this + b; }
+        Fixed &operator-=(Fixed b) { return *this = *this - b; }
+        Fixed &operator*=(Fixed b) { return *this = *this * b; }
+        Fixed &operator/=(Fixed b) { return *this = *this / b; }
+
+        friend constexpr bool operator==(Fixed a, Fixed b) { return a.raw == b.raw; }
+        friend constexpr bool operator!=(Fixed a, Fixed b) { return a.raw != b.raw; }
+        friend constexpr bool operator<(Fixed a, Fixed b) { return a.raw < b.raw; }
+        friend constexpr bool operator<=(Fixed a, Fixed b) { return a.raw <= b.raw; }
+        friend constexpr bool operator>(Fixed a, Fixed b) { return a.raw > b.raw; }
+        friend constexpr bool operator>=(Fixed a, Fixed b) { return a.raw >= b.raw; }
+
+        friend std::ostream &operator<<(std::ostream &os, Fixed value) {
+            return os << (double) value;
+        }
+
+    private:
+        struct RawTag {};
+
+        constexpr Fixed(int32_t raw, RawTag) : raw(raw) {}
+
+        int32_t raw;
+    };
+
+    /** The square root, rounded down. Zero for negative numbers. */
+    inline Fixed fixedSqrt(Fixed x) {
+        if (x.getRaw() <= 0) return Fixed();
+
+        // The root of raw * 2^16, bit by bit, is the raw root.
+        uint64_t remainder = (uint64_t) x.getRaw() << Fixed::FRACTION_BITS;
+        uint64_t root = 0;
+        uint64_t bit = (uint64_t) 1 << 46;
+        while (bit > remainder) bit >>= 2;
+
+        while (bit != 0) {
+            if (remainder >= root + bit) {
+                remainder -= root + bit;
+                root = (root >> 1) + bit;
+            } else {
+                root >>= 1;
+            }
+            bit >>= 2;
+        }
+        return Fixed::fromRaw((int32_t) root);
+    }
+
+    /** The base 2 logarithm of a positive number. */
+    inline Fixed fixedLog2(Fixed x) {
+        if (x.getRaw() <= 0) return Fixed::fromRaw(INT32_MIN);
+
+        // Normalise to [1, 2) with 30 fraction bits, the exponent being the integer part.
+        const uint32_t raw = (uint32_t) x.getRaw();
+        int highest = 31;
+        while (!(raw & (1u << highest))) highest--;
+
+        int32_t result = (highest - Fixed::FRACTION_BITS) * Fixed::ONE;
+        uint64_t z = highest >= 30 ? raw >> (highest - 30) : (uint64_t) raw << (30 - highest);
+
+        // Each squaring gives the next bit of the fraction.
+        for (int bit = Fixed::FRACTION_BITS - 1; bit >= 0; bit--) {
+            z = (z * z) >> 30;
+            if (z >= (uint64_t) 2 << 30) {
+                z >>= 1;
+                result += 1 << bit;
+            }
+        }
+        return Fixed::fromRaw(result);
+    }
+
+    /** 2 to the given power. Saturates to Fixed::max() from 2^15 up, which is out of the range. */
+    inline Fixed fixedExp2(Fixed x) {
+        // 2^(2^-i) for i in [1, 16], with 30 fraction bits.
+        static const uint32_t ROOTS[] = {
+                0x5a82799a, 0x4c1bf829, 0x45cae0f2, 0x42d561b4, 0x4166c34c, 0x40b268fa, 0x4058f6a8, 0x402c6be9,
+                0x4016321b, 0x400b1818, 0x40058bce, 0x4002c5d8, 0x400162e8, 0x4000b173, 0x400058b9, 0x40002c5d
+        };
+
+        const int32_t integer = x.getRaw() >> Fixed::FRACTION_BITS;
+        const uint32_t fraction = (uint32_t) x.getRaw() & (Fixed::ONE - 1);
+
+        uint64_t result = (uint64_t) 1 << 30;
+        for (int i = 0; i < Fixed::FRACTION_BITS; i++) {
+            if (fraction & (1u << (Fixed::FRACTION_BITS - 1 - i))) {
+                result = (result * ROOTS[i]) >> 30;
+            }
+        }
+
+        // From 30 to 16 fraction bits, times 2^integer. The result is in [2^30, 2^31), so any
+        // shift to the left, from an integer part of 15 up, would not fit in 31 bits.
+        const int shift = 30 - Fixed::FRACTION_BITS - integer;
+        if (shift >= 63) return Fixed();
+        if (shift < 0) return Fixed::max();
+        return Fixed::fromRaw((int32_t) (result >> shift));
+    }
+
+    /** The base to the given power, for positive bases. */
+    inline Fixed fixedPow(Fixed base, Fixed exponent) {
+        return fixedExp2(exponent * fixedLog2(base));
+    }
+}
+
+#endif // PHYGINE_FIXED
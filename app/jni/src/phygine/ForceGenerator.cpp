@@ -1,6 +1,8 @@
 #ifndef PHYGINE_PARTICALE_GENERATOR
 #define PHYGINE_PARTICALE_GENERATOR
 
+#include "Particle.cpp"
+
 namespace phygine {
 /**
  * A force generator can be asked to add a force to one or more particles.
@@ -12,6 +14,21 @@ namespace phygine {
          * and update the force applied to the given particle.
          */
         virtual void updateForce(Particle *particle, real duration) = 0;
+
+        /**
+         * Updates the force of all the given particles. The registry
+         * calls this with slices of the particles of each generator,
+         * in chunks of ForceRegistry::CHUNK. The default calls
+         * updateForce for each of them; overload it to apply the force
+         * in one tight loop.
+         */
+        virtual void updateForces(Particle *const *particles, unsigned count, real duration) {
+            for (unsigned i = 0; i < count; i++) {
+                updateForce(particles[i], duration);
+            }
+        }
+
+        virtual ~ParticleForceGenerator() = default;
     };
 }
 
@@ -1,37 +1,109 @@
 #ifndef PHYGINE_FORCE_REGISTRY
 #define PHYGINE_FORCE_REGISTRY
 
+#include <vector>
+
 #include "Particle.cpp"
 #include "ForceGenerator.cpp"
 
 namespace phygine {
     /**
      * Holds all the force generators and the particles they apply to.
+     *
+     * Registrations are grouped by generator: each generator keeps
+     * a contiguous array of its particles, and is called with slices
+     * of it (see ParticleForceGenerator::updateForces).
+     *
+     * The groups are updated a chunk of registrations at a time, each
+     * chunk going through every generator. A particle registered at
+     * the same index with several generators, as when they are all
+     * added particle by particle, is then read from memory once per
+     * update rather than once per generator.
      */
     class ForceRegistry {
-    protected:
+    public:
+        /** Registrations per generator updated at a time, see updateForces. */
+        static const unsigned CHUNK = 256;
+
         /**
-         * Keeps track of one force generator and the particle it
-         * applies to.
+         * Identifies a registration, to remove it in constant time.
+         * A handle must not be used once its registration is removed.
          */
-        struct ParticleForceRegistration {
-            Particle *particle;
+        typedef unsigned Handle;
+
+        static const Handle NONE = ~0u;
+
+    protected:
+        /** A force generator and all the particles it applies to. */
+        struct Group {
             ParticleForceGenerator *fg;
+            std::vector<Particle *> particles;
+            /** The handle of each registration, in the order of particles. */
+            std::vector<Handle> handles;
+        };
+        std::vector<Group> groups;
+
+        /**
+         * Where the registration of each handle is. Slots of removed
+         * registrations are chained in a free list, through index.
+         */
+        struct Slot {
+            unsigned group;
+            unsigned index;
         };
-        typedef std::vector <ParticleForceRegistration> Registry;
-        Registry registrations;
+        std::vector<Slot> slots;
+        Handle freeSlots = NONE;
+
+        /** The room reserved in the arrays of the new groups. */
+        unsigned registrationsPerGroup = 0;
+
+        /** Gets the group of the given generator, creating it if needed. */
+        unsigned groupOf(ParticleForceGenerator *fg) {
+            // There are few generators, a linear search is fine.
+            for (unsigned g = 0; g < groups.size(); g++) {
+                if (groups[g].fg == fg) return g;
+            }
+
+            // A generator whose registrations were all cleared keeps its
+            // group, and the memory of its arrays.
+            for (unsigned g = 0; g < groups.size(); g++) {
+                if (groups[g].fg == nullptr) {
+                    groups[g].fg = fg;
+                    return g;
+                }
+            }
+
+            groups.push_back(Group());
+            groups.back().fg = fg;
+            groups.back().particles.reserve(registrationsPerGroup);
+            groups.back().handles.reserve(registrationsPerGroup);
+            return (unsigned) groups.size() - 1;
+        }
 
     public:
         /**
          * Registers the given force generator to apply to the
          * given particle.
+         *
+         * @return the handle of the registration.
          */
-        void add(Particle *particle, ParticleForceGenerator *fg) {
-            ParticleForceRegistration reg;
-            reg.particle = particle;
-            reg.fg = fg;
+        Handle add(Particle *particle, ParticleForceGenerator *fg) {
+            const unsigned g = groupOf(fg);
+            Group &group = groups[g];
+
+            Handle handle = freeSlots;
+            if (handle == NONE) {
+                handle = (Handle) slots.size();
+                slots.push_back(Slot());
+            } else {
+                freeSlots = slots[handle].index;
+            }
 
-            this->registrations.push_back(reg);
+            slots[handle].group = g;
+            slots[handle].index = (unsigned) group.particles.size();
+            group.particles.push_back(particle);
+            group.handles.push_back(handle);
+            return handle;
         }
 
         /**
@@ -39,39 +111,102 @@ namespace phygine {
          * their corresponding particles.
          */
         void updateForces(real duration) {
-            for (auto &reg : this->registrations) // access by reference to avoid copying
-            {
-                reg.fg->updateForce(reg.particle, duration);
+            size_t longest = 0;
+            for (const Group &group : this->groups) {
+                if (group.particles.size() > longest) longest = group.particles.size();
             }
+
+            // The particles of a chunk stay in the cache from one generator to the next.
+            for (size_t start = 0; start < longest; start += CHUNK) {
+                for (Group &group : this->groups) {
+                    if (group.particles.size() <= start) continue;
+
+                    const size_t left = group.particles.size() - start;
+                    const unsigned count = left < CHUNK ? (unsigned) left : CHUNK;
+                    group.fg->updateForces(group.particles.data() + start, count, duration);
+                }
+            }
+        }
+
+        /**
+         * Removes the registration of the given handle, by moving the
+         * last registration of its generator in its place.
+         */
+        void remove(Handle handle) {
+            const Slot slot = slots[handle];
+            Group &group = groups[slot.group];
+
+            const Handle moved = group.handles.back();
+            group.particles[slot.index] = group.particles.back();
+            group.handles[slot.index] = moved;
+            slots[moved].index = slot.index;
+            group.particles.pop_back();
+            group.handles.pop_back();
+
+            slots[handle].index = freeSlots;
+            freeSlots = handle;
         }
 
         /**
          * Removes the given registered pair from the registry.
          * If the pair is not registered, this method will have
-         * no effect.
+         * no effect. Prefer remove(Handle), which does not search.
          */
         void remove(Particle *particle, ParticleForceGenerator *fg) {
-            this->registrations.erase(
-                    std::remove_if(
-                            this->registrations.begin(),
-                            this->registrations.end(),
-                            [particle, fg](const ParticleForceRegistration& reg) {
-                                return reg.particle == particle && reg.fg == fg;
-                            }
-                    ),
-                    this->registrations.end()
-            );
+            for (Group &group : this->groups) {
+                if (group.fg != fg) continue;
+
+                // Removing moves the last registration at i, which must be checked too.
+                for (unsigned i = 0; i < group.particles.size();) {
+                    if (group.particles[i] == particle) {
+                        remove(group.handles[i]);
+                    } else {
+                        i++;
+                    }
+                }
+            }
+        }
+
+        /**
+         * Allocates the room for the given number of generators, and of
+         * registrations per generator, so that adding up to that many
+         * does not allocate.
+         */
+        void reserve(unsigned generators, unsigned registrations) {
+            groups.reserve(generators);
+            slots.reserve(generators * registrations);
+            for (Group &group : this->groups) {
+                group.particles.reserve(registrations);
+                group.handles.reserve(registrations);
+            }
+            this->registrationsPerGroup = registrations;
+        }
+
+        /** Number of registrations. */
+        unsigned size() const {
+            unsigned count = 0;
+            for (const Group &group : this->groups) {
+                count += (unsigned) group.particles.size();
+            }
+            return count;
         }
 
         /**
          * Clears all registrations from the registry. This will
          * not delete the particles or the force generators
-         * themselves, just the records of their connection.
+         * themselves, just the records of their connection. The memory is
+         * kept, to register again without allocating.
          */
         void clear() {
-            this->registrations.clear();
+            for (Group &group : this->groups) {
+                group.fg = nullptr;
+                group.particles.clear();
+                group.handles.clear();
+            }
+            this->slots.clear();
+            this->freeSlots = NONE;
         }
     };
 }
 
-#endif // PHYGINE_FORCE_REGISTRY
\ No newline at end of file
+#endif // PHYGINE_FORCE_REGISTRY
@@ -41,6 +41,24 @@ namespace phygine {
             this->inverseMass = 1 / mass;
         }
 
+        /** Gets the mass of the particle, or the largest real for an infinite mass. */
+        real getMass() const {
+            return inverseMass == 0 ? REAL_MAX : 1 / inverseMass;
+        }
+
+        /** Whether the particle can be moved by forces. */
+        bool hasFiniteMass() const {
+            return inverseMass > 0;
+        }
+
+        real getInverseMass() const {
+            return inverseMass;
+        }
+
+        const Vector3 &getPosition() const {
+            return position;
+        }
+
         void setInverseMass(real inverseMass) {
             this->inverseMass = inverseMass;
         }
@@ -62,6 +62,22 @@ public:
         force.y = liquidDensity * volume * (depth - maxDepth - waterHeight) / 2 * maxDepth;
         particle->addForce(force);
     }
+
+    /** Applies the buoyancy force to all the given particles, in one loop. */
+    virtual void updateForces(Particle *const *particles, unsigned count, real duration) {
+        const real fullForce = liquidDensity * volume;
+        const real partialScale = fullForce / 2 * maxDepth;
+        const real top = waterHeight + maxDepth;
+        const real bottom = waterHeight - maxDepth;
+
+        for (unsigned i = 0; i < count; i++) {
+            const real depth = particles[i]->position.y;
+            if (depth >= top) continue;
+
+            // Only y changes: no need to go through a whole vector.
+            particles[i]->forceAccum.y += depth <= bottom ? fullForce : (depth - top) * partialScale;
+        }
+    }
 };
 
 #endif // PHYGINE_BUOYANCY_H
\ No newline at end of file
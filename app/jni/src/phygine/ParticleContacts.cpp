@@ -0,0 +1,388 @@
+#ifndef PHYGINE_PARTICLE_CONTACTS
+#define PHYGINE_PARTICLE_CONTACTS
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "precision.cpp"
+#include "Vector3.cpp"
+#include "Particle.cpp"
+#include "../utils/JobSystem.cpp"
+
+namespace phygine {
+    /**
+     * A contact represents two particles in contact (or one particle
+     * in contact with the immovable scenery). Resolving a contact
+     * removes their interpenetration, and applies sufficient impulse
+     * to keep them apart. Colliding bodies may also rebound.
+     *
+     * The contact has no callable functions, it just holds the contact
+     * details. To resolve a set of contacts, use the particle contact
+     * resolver class.
+     */
+    class ParticleContact {
+    public:
+        /**
+         * Holds the particles that are involved in the contact. The
+         * second of these can be null, for contacts with the scenery.
+         */
+        Particle *particle[2];
+
+        /** Holds the normal restitution coefficient at the contact. */
+        real restitution;
+
+        /**
+         * Holds the direction of the contact in world coordinates: the
+         * direction the first particle is pushed to resolve it, the
+         * second one being pushed the other way.
+         */
+        Vector3 contactNormal;
+
+        /** Holds the depth of penetration at the contact. */
+        real penetration;
+
+        /**
+         * Holds the amount each particle is moved by during
+         * interpenetration resolution.
+         */
+        Vector3 particleMovement[2];
+
+    protected:
+        friend class ParticleContactResolver;
+
+        /** Resolves this contact, for both velocity and interpenetration. */
+        void resolve(real duration) {
+            resolveVelocity(duration);
+            resolveInterpenetration(duration);
+        }
+
+        /** Calculates the separating velocity at this contact. */
+        real calculateSeparatingVelocity() const {
+            Vector3 relativeVelocity = particle[0]->velocity;
+            if (particle[1]) relativeVelocity -= particle[1]->velocity;
+            return relativeVelocity * contactNormal;
+        }
+
+    private:
+        /** Handles the impulse calculations for this collision. */
+        void resolveVelocity(real duration) {
+            // Find the velocity in the direction of the contact.
+            const real separatingVelocity = calculateSeparatingVelocity();
+
+            // Check if it needs to be resolved: the contact is either
+            // separating, or stationary, there's no impulse required.
+            if (separatingVelocity > 0) return;
+
+            // Calculate the new separating velocity.
+            real newSepVelocity = -separatingVelocity * restitution;
+
+            // Check the velocity build-up due to acceleration only, so
+            // that resting contacts do not jitter.
+            Vector3 accCausedVelocity = particle[0]->acceleration;
+            if (particle[1]) accCausedVelocity -= particle[1]->acceleration;
+            const real accCausedSepVelocity = accCausedVelocity * contactNormal * duration;
+
+            // If we've got a closing velocity due to acceleration build-up,
+            // remove it from the new separating velocity.
+            if (accCausedSepVelocity < 0) {
+                newSepVelocity += restitution * accCausedSepVelocity;
+                if (newSepVelocity < 0) newSepVelocity = 0;
+            }
+
+            const real deltaVelocity = newSepVelocity - separatingVelocity;
+
+            // We apply the change in velocity to each object in proportion
+            // to its inverse mass.
+            real totalInverseMass = particle[0]->getInverseMass();
+            if (particle[1]) totalInverseMass += particle[1]->getInverseMass();
+
+            // If all particles have infinite mass, then impulses have no effect.
+            if (totalInverseMass <= 0) return;
+
+            // Find the amount of impulse per unit of inverse mass.
+            const Vector3 impulsePerIMass = contactNormal * (deltaVelocity / totalInverseMass);
+
+            // Apply impulses: they are applied in the direction of the
+            // contact, and are proportional to the inverse mass.
+            particle[0]->velocity.addScaledVector(impulsePerIMass, particle[0]->getInverseMass());
+            if (particle[1]) {
+                // Particle 1 goes in the opposite direction.
+                particle[1]->velocity.addScaledVector(impulsePerIMass, -particle[1]->getInverseMass());
+            }
+        }
+
+        /** Handles the interpenetration resolution for this contact. */
+        void resolveInterpenetration(real duration) {
+            particleMovement[0].clear();
+            particleMovement[1].clear();
+
+            // If we don't have any penetration, skip this step.
+            if (penetration <= 0) return;
+
+            // The movement of each object is based on its inverse mass.
+            real totalInverseMass = particle[0]->getInverseMass();
+            if (particle[1]) totalInverseMass += particle[1]->getInverseMass();
+
+            // If all particles have infinite mass, then we do nothing.
+            if (totalInverseMass <= 0) return;
+
+            // Find the amount of penetration resolution per unit of inverse mass.
+            const Vector3 movePerIMass = contactNormal * (penetration / totalInverseMass);
+
+            // Calculate the movement amounts, and apply them.
+            particleMovement[0] = movePerIMass * particle[0]->getInverseMass();
+            particle[0]->position += particleMovement[0];
+            if (particle[1]) {
+                particleMovement[1] = movePerIMass * -particle[1]->getInverseMass();
+                particle[1]->position += particleMovement[1];
+            }
+            penetration = 0;
+        }
+    };
+
+    /**
+     * The contact resolution routine for particle contacts. One
+     * resolver instance can be shared for the whole simulation.
+     *
+     * Contacts are resolved in sweeps (iterations) over all of them.
+     * Before the first sweep, the contacts are split into batches where
+     * no particle appears twice (a greedy colouring of the contact
+     * graph). The contacts of a batch are independent, so with a job
+     * system each batch is resolved across the cores. The batches are
+     * resolved one after the other, so every contact sees the effect of
+     * the previous batches on its particles.
+     *
+     * The resolver stops after the given number of iterations, or as
+     * soon as a sweep leaves no contact closing faster than, or
+     * penetrating deeper than, the tolerance.
+     */
+    class ParticleContactResolver {
+    protected:
+        /** Holds the maximum number of iterations allowed. */
+        unsigned iterations;
+
+        /** The error under which the contacts are considered resolved. */
+        real tolerance;
+
+        /** This is a performance tracking value: the number of iterations used. */
+        unsigned iterationsUsed = 0;
+
+        /**
+         * The largest error met during the last iteration: the fastest
+         * closing velocity or the deepest penetration of a contact, before
+         * resolving it. Below the tolerance if the resolution converged.
+         */
+        real residual = 0;
+
+        /** Resolves the contacts of a batch across the cores, if set. */
+        JobSystem *jobs = nullptr;
+
+        /** Batches smaller than this are resolved on the calling thread. */
+        const static unsigned grain = 256;
+
+        /** The contact indices, sorted by batch, and where each batch starts. */
+        std::vector<unsigned> order;
+        std::vector<unsigned> batchStart;
+
+        /** A dense index for each particle, and the batches it is already in. */
+        std::unordered_map<Particle *, unsigned> particleIds;
+        std::vector<uint64_t> particleBatches;
+
+        /**
+         * How far each particle has been moved during this resolution, and
+         * how far it had been when each contact last updated its penetration.
+         */
+        std::vector<Vector3> moved;
+        std::vector<Vector3> seen;
+        std::vector<unsigned> contactParticles;
+
+        /** The error of each contact at the start of the iteration. */
+        std::vector<real> errors;
+
+    public:
+        /**
+         * Maximum number of batches. The contacts that fit in none of the
+         * others go in the last one, which is resolved serially.
+         */
+        const static unsigned maxBatches = 64;
+
+        /** Creates a new contact resolver. */
+        explicit ParticleContactResolver(unsigned iterations, real tolerance = 0.001f)
+                : iterations(iterations), tolerance(tolerance) {}
+
+        /** Sets the number of iterations that can be used. */
+        void setIterations(unsigned iterations) {
+            this->iterations = iterations;
+        }
+
+        void setTolerance(real tolerance) {
+            this->tolerance = tolerance;
+        }
+
+        /** Sets the job system used to resolve the batches, or none to stay on the calling thread. */
+        void setJobSystem(JobSystem *jobs) {
+            this->jobs = jobs;
+        }
+
+        unsigned getIterationsUsed() const {
+            return iterationsUsed;
+        }
+
+        real getResidual() const {
+            return residual;
+        }
+
+        /** Number of independent batches the last contacts were split into. */
+        unsigned getBatchCount() const {
+            return batchStart.empty() ? 0 : (unsigned) batchStart.size() - 1;
+        }
+
+        /** Resolves a set of particle contacts for both penetration and velocity. */
+        void resolveContacts(ParticleContact *contactArray, unsigned numContacts, real duration) {
+            iterationsUsed = 0;
+            residual = 0;
+            if (numContacts == 0) return;
+
+            _batch(contactArray, numContacts);
+
+            for (unsigned id = 0; id < moved.size(); id++) {
+                moved[id].clear();
+            }
+            seen.assign(2 * numContacts, Vector3());
+            errors.resize(numContacts);
+
+            while (iterationsUsed < iterations) {
+                for (unsigned batch = 0; batch + 1 < batchStart.size(); batch++) {
+                    const unsigned begin = batchStart[batch], end = batchStart[batch + 1];
+
+                    auto resolveRange = [&](unsigned first, unsigned last) {
+                        for (unsigned k = first; k < last; k++) {
+                            _resolve(contactArray, order[k], duration);
+                        }
+                    };
+
+                    // The last batch holds the contacts left over by the colouring, which may share particles.
+                    if (jobs && end - begin > grain && batch < maxBatches - 1) {
+                        jobs->parallelFor(begin, end, grain, resolveRange);
+                    } else {
+                        resolveRange(begin, end);
+                    }
+                }
+                iterationsUsed++;
+
+                residual = 0;
+                for (unsigned i = 0; i < numContacts; i++) {
+                    if (errors[i] > residual) residual = errors[i];
+                }
+                if (residual < tolerance) break;
+            }
+        }
+
+    private:
+        /** Splits the contacts into batches where each particle appears at most once. */
+        void _batch(ParticleContact *contactArray, unsigned numContacts) {
+            particleIds.clear();
+            particleBatches.clear();
+            contactParticles.resize(2 * numContacts);
+
+            std::vector<unsigned> batchOf(numContacts);
+            unsigned batchCount = 0;
+            for (unsigned i = 0; i < numContacts; i++) {
+                uint64_t used = 0;
+                for (unsigned p = 0; p < 2; p++) {
+                    Particle *particle = contactArray[i].particle[p];
+                    if (!particle) {
+                        contactParticles[2 * i + p] = ~0u;
+                        continue;
+                    }
+
+                    auto inserted = particleIds.emplace(particle, (unsigned) particleBatches.size());
+                    if (inserted.second) particleBatches.push_back(0);
+                    const unsigned id = inserted.first->second;
+                    contactParticles[2 * i + p] = id;
+                    used |= particleBatches[id];
+                }
+
+                // The first batch none of the particles is in yet, or the last one for the leftovers.
+                unsigned batch = 0;
+                while (batch < maxBatches - 1 && (used & ((uint64_t) 1 << batch))) batch++;
+
+                batchOf[i] = batch;
+                if (batch + 1 > batchCount) batchCount = batch + 1;
+                for (unsigned p = 0; p < 2; p++) {
+                    const unsigned id = contactParticles[2 * i + p];
+                    if (id != ~0u) particleBatches[id] |= (uint64_t) 1 << batch;
+                }
+            }
+            moved.resize(particleBatches.size());
+
+            // Counting sort of the contacts by batch.
+            batchStart.assign(batchCount + 1, 0);
+            for (unsigned i = 0; i < numContacts; i++) {
+                batchStart[batchOf[i] + 1]++;
+            }
+            for (unsigned batch = 0; batch < batchCount; batch++) {
+                batchStart[batch + 1] += batchStart[batch];
+            }
+            std::vector<unsigned> cursor(batchStart.begin(), batchStart.end() - 1);
+            order.resize(numContacts);
+            for (unsigned i = 0; i < numContacts; i++) {
+                order[cursor[batchOf[i]]++] = i;
+            }
+        }
+
+        /**
+         * Brings the penetration of the contact up to date with the moves
+         * of its particles by other contacts, then resolves it.
+         */
+        void _resolve(ParticleContact *contactArray, unsigned i, real duration) {
+            ParticleContact &contact = contactArray[i];
+            const unsigned ids[2] = {contactParticles[2 * i], contactParticles[2 * i + 1]};
+
+            for (unsigned p = 0; p < 2; p++) {
+                if (ids[p] == ~0u) continue;
+
+                const Vector3 delta = moved[ids[p]] - seen[2 * i + p];
+                contact.penetration += p == 0 ? -(delta * contact.contactNormal) : delta * contact.contactNormal;
+            }
+
+            const real closing = -contact.calculateSeparatingVelocity();
+            errors[i] = closing > contact.penetration ? closing : contact.penetration;
+
+            if (closing > 0 || contact.penetration > 0) {
+                contact.resolve(duration);
+            } else {
+                contact.particleMovement[0].clear();
+                contact.particleMovement[1].clear();
+            }
+
+            for (unsigned p = 0; p < 2; p++) {
+                if (ids[p] == ~0u) continue;
+
+                moved[ids[p]] += contact.particleMovement[p];
+                seen[2 * i + p] = moved[ids[p]];
+            }
+        }
+    };
+
+    /**
+     * This is the basic polymorphic interface for contact generators
+     * applying to particles.
+     */
+    class ParticleContactGenerator {
+    public:
+        /**
+         * Fills the given contact structure with the generated contact.
+         * The contact pointer should point to the first available
+         * contact in a contact array, where limit is the maximum number
+         * of contacts in the array that can be written to. The method
+         * returns the number of contacts that have been written.
+         */
+        virtual unsigned addContact(ParticleContact *contact, unsigned limit) const = 0;
+
+        virtual ~ParticleContactGenerator() = default;
+    };
+}
+
+#endif // PHYGINE_PARTICLE_CONTACTS
@@ -0,0 +1,44 @@
+#ifndef PHYGINE_GRAVITY
+#define PHYGINE_GRAVITY
+
+#include "precision.cpp"
+#include "Vector3.cpp"
+#include "Particle.cpp"
+#include "ForceGenerator.cpp"
+
+namespace phygine {
+    /**
+     * A force generator that applies a gravitational force. One
+     * instance can be used for multiple particles.
+     */
+    class ParticleGravity : public ParticleForceGenerator {
+        /** Holds the acceleration due to gravity. */
+        Vector3 gravity;
+
+    public:
+        /** Creates the generator with the given acceleration. */
+        explicit ParticleGravity(const Vector3 &gravity) : gravity(gravity) {}
+
+        /** Applies the gravitational force to the given particle. */
+        virtual void updateForce(Particle *particle, real duration) {
+            // Check that we do not have infinite mass.
+            if (!particle->hasFiniteMass()) return;
+
+            // Apply the mass-scaled force to the particle.
+            particle->addForce(gravity * particle->getMass());
+        }
+
+        /** Applies the gravitational force to all the given particles, in one loop. */
+        virtual void updateForces(Particle *const *particles, unsigned count, real duration) {
+            for (unsigned i = 0; i < count; i++) {
+                Particle *particle = particles[i];
+                const real inverseMass = particle->getInverseMass();
+                if (inverseMass <= 0) continue;
+
+                particle->forceAccum.addScaledVector(gravity, 1 / inverseMass);
+            }
+        }
+    };
+}
+
+#endif // PHYGINE_GRAVITY
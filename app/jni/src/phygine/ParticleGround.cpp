@@ -0,0 +1,52 @@
+#ifndef PHYGINE_PARTICLE_GROUND
+#define PHYGINE_PARTICLE_GROUND
+
+#include <vector>
+
+#include "precision.cpp"
+#include "Vector3.cpp"
+#include "Particle.cpp"
+#include "ParticleContacts.cpp"
+
+namespace phygine {
+    /**
+     * A contact generator for a ground plane at a given height, parallel
+     * to the XZ plane, that a set of particles cannot go through.
+     */
+    class ParticleGround : public ParticleContactGenerator {
+    public:
+        /** The particles kept above the ground. */
+        std::vector<Particle *> particles;
+
+        /** The height of the ground. */
+        real height;
+
+        /** The restitution (bounciness) of the ground. */
+        real restitution;
+
+        explicit ParticleGround(real height = 0, real restitution = 0.2f)
+                : height(height), restitution(restitution) {}
+
+        /** Adds one contact for every particle below the ground, up to the limit. */
+        virtual unsigned addContact(ParticleContact *contact, unsigned limit) const {
+            unsigned count = 0;
+            for (Particle *particle : particles) {
+                if (count == limit) break;
+
+                const real y = particle->position.y;
+                if (y >= height) continue;
+
+                contact->particle[0] = particle;
+                contact->particle[1] = nullptr;
+                contact->contactNormal = Vector3(0, 1, 0);
+                contact->penetration = height - y;
+                contact->restitution = restitution;
+                contact++;
+                count++;
+            }
+            return count;
+        }
+    };
+}
+
+#endif // PHYGINE_PARTICLE_GROUND
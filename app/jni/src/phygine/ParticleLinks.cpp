@@ -0,0 +1,98 @@
+#ifndef PHYGINE_PARTICLE_LINKS
+#define PHYGINE_PARTICLE_LINKS
+
+#include "precision.cpp"
+#include "Vector3.cpp"
+#include "Particle.cpp"
+#include "ParticleContacts.cpp"
+
+namespace phygine {
+    /**
+     * Links connect two particles together, generating a contact if
+     * they violate the constraints of their link. It is used as a
+     * base class for cables and rods.
+     */
+    class ParticleLink : public ParticleContactGenerator {
+    public:
+        /** Holds the pair of particles that are connected by this link. */
+        Particle *particle[2];
+
+    protected:
+        /** Returns the current length of the link. */
+        real currentLength() const {
+            const Vector3 relativePos = particle[0]->position - particle[1]->position;
+            return relativePos.magnitude();
+        }
+
+        /** Fills the contact between the two particles, along the link. */
+        void fillContact(ParticleContact *contact, real penetration, real restitution) const {
+            contact->particle[0] = particle[0];
+            contact->particle[1] = particle[1];
+
+            Vector3 normal = particle[1]->position - particle[0]->position;
+            normal.normalise();
+            contact->contactNormal = normal;
+            contact->penetration = penetration;
+            contact->restitution = restitution;
+        }
+    };
+
+    /**
+     * Cables link a pair of particles, generating a contact if they
+     * stray too far apart.
+     */
+    class ParticleCable : public ParticleLink {
+    public:
+        /** Holds the maximum length of the cable. */
+        real maxLength;
+
+        /** Holds the restitution (bounciness) of the cable. */
+        real restitution;
+
+        /** Fills the given contact structure with the contact needed to keep the cable from over-extending. */
+        virtual unsigned addContact(ParticleContact *contact, unsigned limit) const {
+            if (limit == 0) return 0;
+
+            // Check if we're over-extended.
+            const real length = currentLength();
+            if (length < maxLength) return 0;
+
+            // Otherwise return the contact, pulling the particles together.
+            fillContact(contact, length - maxLength, restitution);
+            return 1;
+        }
+    };
+
+    /**
+     * Rods link a pair of particles, generating a contact if they
+     * stray too far apart or too close.
+     */
+    class ParticleRod : public ParticleLink {
+    public:
+        /** Holds the length of the rod. */
+        real length;
+
+        /** Fills the given contact structure with the contact needed to keep the rod from extending or compressing. */
+        virtual unsigned addContact(ParticleContact *contact, unsigned limit) const {
+            if (limit == 0) return 0;
+
+            // Find the length of the rod.
+            const real currentLen = currentLength();
+
+            // Check if we're over-extended.
+            if (currentLen == length) return 0;
+
+            // The contact normal depends on whether we're extending or
+            // compressing. Always use zero restitution (no bounciness).
+            if (currentLen > length) {
+                fillContact(contact, currentLen - length, 0);
+            } else {
+                fillContact(contact, length - currentLen, 0);
+                contact->contactNormal.invert();
+            }
+            return 1;
+        }
+    };
+}
+
+#endif // PHYGINE_PARTICLE_LINKS
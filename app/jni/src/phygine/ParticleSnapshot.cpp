@@ -0,0 +1,89 @@
+#ifndef PHYGINE_PARTICLE_SNAPSHOT
+#define PHYGINE_PARTICLE_SNAPSHOT
+
+#include <stdint.h>
+#include <vector>
+
+namespace phygine {
+    /**
+     * A read-only copy of what is needed to draw a set of particles at a
+     * given simulation step, so that it can be rendered while the
+     * simulation keeps running on another thread.
+     */
+    struct ParticleSnapshot {
+        /** Holds the positions of the particles at the step, and at the one before. */
+        std::vector<float> x, y;
+        std::vector<float> previousX, previousY;
+
+        /** Holds the color of each particle, packed as RGBA. */
+        std::vector<uint32_t> color;
+
+        /** Holds the size of each particle on screen, in pixels. */
+        std::vector<uint8_t> size;
+
+        /** Holds the number of the simulation step the snapshot was taken at. */
+        uint64_t step = 0;
+
+        /** Holds when the snapshot was taken, in performance counter ticks. */
+        uint64_t takenAt = 0;
+
+        /**
+         * Holds when the oldest input the snapshot shows and no presented
+         * snapshot did was made, in the same ticks, or 0 if none.
+         */
+        uint64_t inputAt = 0;
+
+        unsigned count() const {
+            return static_cast<unsigned>(x.size());
+        }
+
+        /**
+         * Gets the box around the particles, at both their positions, and
+         * the largest size. Returns false if there is no particle.
+         */
+        bool bounds(float &minX, float &minY, float &maxX, float &maxY, unsigned &maxSize) const {
+            if (x.empty()) return false;
+
+            minX = maxX = x[0];
+            minY = maxY = y[0];
+            maxSize = 0;
+            for (unsigned i = 0; i < count(); i++) {
+                if (x[i] < minX) minX = x[i];
+                if (x[i] > maxX) maxX = x[i];
+                if (previousX[i] < minX) minX = previousX[i];
+                if (previousX[i] > maxX) maxX = previousX[i];
+                if (y[i] < minY) minY = y[i];
+                if (y[i] > maxY) maxY = y[i];
+                if (previousY[i] < minY) minY = previousY[i];
+                if (previousY[i] > maxY) maxY = previousY[i];
+                if (size[i] > maxSize) maxSize = size[i];
+            }
+            return true;
+        }
+
+        /**
+         * Allocates the room for the given number of particles, so that
+         * resizing up to it does not allocate.
+         */
+        void reserve(unsigned count) {
+            x.reserve(count);
+            y.reserve(count);
+            previousX.reserve(count);
+            previousY.reserve(count);
+            color.reserve(count);
+            size.reserve(count);
+        }
+
+        /** Changes the number of particles, keeping the memory already allocated. */
+        void resize(unsigned count) {
+            x.resize(count);
+            y.resize(count);
+            previousX.resize(count);
+            previousY.resize(count);
+            color.resize(count);
+            size.resize(count);
+        }
+    };
+}
+
+#endif // PHYGINE_PARTICLE_SNAPSHOT
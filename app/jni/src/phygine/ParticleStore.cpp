@@ -0,0 +1,483 @@
+#ifndef PHYGINE_PARTICLE_STORE
+#define PHYGINE_PARTICLE_STORE
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <vector>
+
+#include "precision.cpp"
+#include "Vector3.cpp"
+
+namespace phygine {
+    /**
+     * Holds a set of particles as a structure of arrays.
+     *
+     * Each attribute lives in its own contiguous array, so the integration
+     * loop only streams the bytes it actually uses through the cache, and
+     * the compiler is free to vectorise it. Particles are addressed by
+     * their index in the store.
+     *
+     * The store is also a pool: live particles are always packed in
+     * [0, size()), and the free slots are the tail [size(), capacity()).
+     * Spawning takes the first free slot and killing swaps the last live
+     * particle into the hole, so both are O(1) and every loop over the
+     * particles only costs as much as the live ones.
+     * Note that killing a particle changes the index of the last one.
+     */
+    class ParticleStore {
+    public:
+        /** Returned by spawn() when the store is full. */
+        static const unsigned NONE = ~0u;
+
+        /** Holds the number of particles per chunk of chunkBounds. */
+        static const unsigned BOUNDS_CHUNK = 256;
+
+        /** A box in the XY plane. Empty when min > max. */
+        struct Bounds {
+            real minX, minY, maxX, maxY;
+
+            bool empty() const {
+                return minX > maxX;
+            }
+
+            /** Extends the box to the given point. */
+            void add(real x, real y) {
+                if (x < minX) minX = x;
+                if (x > maxX) maxX = x;
+                if (y < minY) minY = y;
+                if (y > maxY) maxY = y;
+            }
+        };
+
+        /** Holds the linear position of the particles in world space. */
+        std::vector<real> positionX, positionY, positionZ;
+
+        /**
+         * Holds the position of the particles before the last integration
+         * step, to interpolate between the two when rendering.
+         */
+        std::vector<real> previousX, previousY, previousZ;
+
+        /** Holds the linear velocity of the particles in world space. */
+        std::vector<real> velocityX, velocityY, velocityZ;
+
+        /**
+         * Holds the accumulated force to be applied at the next simulation
+         * iteration only. These values are zeroed at each integration step.
+         */
+        std::vector<real> forceX, forceY, forceZ;
+
+        /**
+         * Holds the drag applied to the velocity at each integration step.
+         * The store is meant to be integrated with a fixed step, so this is
+         * the damping raised to the power of the step duration, computed
+         * once when the particle is spawned (see dragForStep).
+         */
+        std::vector<real> drag;
+
+        /** Holds the inverse of the mass of the particles. */
+        std::vector<real> inverseMass;
+
+        /**
+         * Holds the time left to live of the particles. It is decreased
+         * by every integration step.
+         */
+        std::vector<real> age;
+
+        /** Holds an integer type for each particle. */
+        std::vector<unsigned> type;
+
+        /**
+         * Holds the acceleration shared by every particle of the store.
+         * This is gravity in most cases.
+         */
+        Vector3 acceleration;
+
+        /**
+         * Holds a box around each chunk of BOUNDS_CHUNK particles, at both
+         * their previous and last positions, to skip whole chunks at once,
+         * for instance when they are off screen.
+         *
+         * Only set by updateChunkBounds, which must be called after the
+         * particles move. The spawns, kills and setPosition keep the boxes
+         * around their particles, but may leave them larger than needed
+         * until the next update.
+         */
+        std::vector<Bounds> chunkBounds;
+
+        /** Creates a store able to hold the given number of particles. */
+        explicit ParticleStore(unsigned capacity = 0) : count(0) {
+            setCapacity(capacity);
+        }
+
+        /** Gets the number of live particles of the store. */
+        unsigned size() const {
+            return count;
+        }
+
+        /** Gets the number of particles the store can hold. */
+        unsigned capacity() const {
+            return static_cast<unsigned>(type.size());
+        }
+
+        bool full() const {
+            return count == capacity();
+        }
+
+        /**
+         * Changes the number of particles the store can hold. If the new
+         * capacity is lower than the number of live particles, the last
+         * ones are dropped.
+         */
+        void setCapacity(unsigned capacity) {
+            positionX.resize(capacity);
+            positionY.resize(capacity);
+            positionZ.resize(capacity);
+            previousX.resize(capacity);
+            previousY.resize(capacity);
+            previousZ.resize(capacity);
+            velocityX.resize(capacity);
+            velocityY.resize(capacity);
+            velocityZ.resize(capacity);
+            forceX.resize(capacity);
+            forceY.resize(capacity);
+            forceZ.resize(capacity);
+            drag.resize(capacity);
+            inverseMass.resize(capacity);
+            age.resize(capacity);
+            type.resize(capacity);
+            chunkBounds.resize((capacity + BOUNDS_CHUNK - 1) / BOUNDS_CHUNK, _emptyBounds());
+
+            if (count > capacity) count = capacity;
+        }
+
+        /**
+         * Takes a free slot and returns its index, or NONE if the store
+         * is full. The caller is responsible for filling every attribute.
+         */
+        unsigned spawn() {
+            if (full()) return NONE;
+            return count++;
+        }
+
+        /** Gets the number of free slots. */
+        unsigned available() const {
+            return capacity() - count;
+        }
+
+        /**
+         * Takes the given number of free slots at once, and returns the
+         * index of the first: the new particles are [first, first + count).
+         * Returns NONE, taking nothing, if there are not that many free
+         * slots. The caller is responsible for filling every attribute, see
+         * initRange.
+         */
+        unsigned spawn(unsigned count) {
+            if (count > available()) return NONE;
+
+            const unsigned first = this->count;
+            this->count += count;
+            return first;
+        }
+
+        /**
+         * Sets the attributes shared by a range of new particles, and
+         * clears their force accumulators.
+         */
+        void initRange(unsigned first, unsigned count, unsigned type, real inverseMass, real drag) {
+            std::fill_n(this->type.begin() + first, count, type);
+            std::fill_n(this->inverseMass.begin() + first, count, inverseMass);
+            std::fill_n(this->drag.begin() + first, count, drag);
+            std::fill_n(forceX.begin() + first, count, real(0));
+            std::fill_n(forceY.begin() + first, count, real(0));
+            std::fill_n(forceZ.begin() + first, count, real(0));
+            _growChunkBounds(first, first + count);
+        }
+
+        /**
+         * Frees the slot of the given particle by moving the last live
+         * particle into it.
+         */
+        void kill(unsigned i) {
+            assert(i < count);
+
+            const unsigned last = --count;
+            // The last chunk may just have become empty: start it again from nothing.
+            if (last % BOUNDS_CHUNK == 0) chunkBounds[last / BOUNDS_CHUNK] = _emptyBounds();
+            if (i == last) return;
+
+            positionX[i] = positionX[last];
+            positionY[i] = positionY[last];
+            positionZ[i] = positionZ[last];
+            previousX[i] = previousX[last];
+            previousY[i] = previousY[last];
+            previousZ[i] = previousZ[last];
+            velocityX[i] = velocityX[last];
+            velocityY[i] = velocityY[last];
+            velocityZ[i] = velocityZ[last];
+            forceX[i] = forceX[last];
+            forceY[i] = forceY[last];
+            forceZ[i] = forceZ[last];
+            drag[i] = drag[last];
+            inverseMass[i] = inverseMass[last];
+            age[i] = age[last];
+            type[i] = type[last];
+            _growChunkBounds(i, i + 1);
+        }
+
+        /** Kills every particle. */
+        void clear() {
+            count = 0;
+            std::fill(chunkBounds.begin(), chunkBounds.end(), _emptyBounds());
+        }
+
+        Vector3 getPosition(unsigned i) const {
+            return {positionX[i], positionY[i], positionZ[i]};
+        }
+
+        /** Sets the position of the particle, without any motion to interpolate from. */
+        void setPosition(unsigned i, const Vector3 &position) {
+            positionX[i] = previousX[i] = position.x;
+            positionY[i] = previousY[i] = position.y;
+            positionZ[i] = previousZ[i] = position.z;
+            _growChunkBounds(i, i + 1);
+        }
+
+        /**
+         * Gets the position of the particle between the previous integration
+         * step (alpha = 0) and the last one (alpha = 1).
+         */
+        Vector3 getInterpolatedPosition(unsigned i, real alpha) const {
+            return {previousX[i] + (positionX[i] - previousX[i]) * alpha,
+                    previousY[i] + (positionY[i] - previousY[i]) * alpha,
+                    previousZ[i] + (positionZ[i] - previousZ[i]) * alpha};
+        }
+
+        Vector3 getVelocity(unsigned i) const {
+            return {velocityX[i], velocityY[i], velocityZ[i]};
+        }
+
+        void setVelocity(unsigned i, const Vector3 &velocity) {
+            velocityX[i] = velocity.x;
+            velocityY[i] = velocity.y;
+            velocityZ[i] = velocity.z;
+        }
+
+        void addForce(unsigned i, const Vector3 &force) {
+            forceX[i] += force.x;
+            forceY[i] += force.y;
+            forceZ[i] += force.z;
+        }
+
+        void clearAccumulator(unsigned i) {
+            forceX[i] = forceY[i] = forceZ[i] = 0;
+        }
+
+        /**
+         * Gets the box around the live particles in the XY plane, at both
+         * their previous and last positions, so that any position
+         * interpolated between the two is inside. Returns false if there
+         * is no live particle.
+         */
+        bool bounds(real &minX, real &minY, real &maxX, real &maxY) const {
+            if (count == 0) return false;
+
+            minX = maxX = positionX[0];
+            minY = maxY = positionY[0];
+            for (unsigned i = 0; i < count; i++) {
+                if (positionX[i] < minX) minX = positionX[i];
+                if (positionX[i] > maxX) maxX = positionX[i];
+                if (previousX[i] < minX) minX = previousX[i];
+                if (previousX[i] > maxX) maxX = previousX[i];
+                if (positionY[i] < minY) minY = positionY[i];
+                if (positionY[i] > maxY) maxY = positionY[i];
+                if (previousY[i] < minY) minY = previousY[i];
+                if (previousY[i] > maxY) maxY = previousY[i];
+            }
+            return true;
+        }
+
+        /**
+         * Hashes the motion state of the live particles (FNV-1a over the
+         * bits of their positions, velocities, ages and types), chained
+         * from the given seed. Two runs match if their hashes do.
+         */
+        uint64_t hash(uint64_t seed = 14695981039346656037ull) const {
+            uint64_t result = _hash(seed, &count, sizeof(count));
+            const std::vector<real> *attributes[] = {&positionX, &positionY, &positionZ, &velocityX, &velocityY, &velocityZ, &age};
+            for (const std::vector<real> *attribute : attributes) {
+                result = _hash(result, attribute->data(), count * sizeof(real));
+            }
+            return _hash(result, type.data(), count * sizeof(unsigned));
+        }
+
+        /**
+         * Computes the boxes of the chunks of the particles in [begin, end),
+         * which must start on a chunk. Call it once they have moved, for
+         * instance right after integrating them, while they are in cache.
+         */
+        void updateChunkBounds(unsigned begin, unsigned end) {
+            assert(begin % BOUNDS_CHUNK == 0);
+
+            for (unsigned first = begin; first < end; first += BOUNDS_CHUNK) {
+                const unsigned last = end - first < BOUNDS_CHUNK ? end : first + BOUNDS_CHUNK;
+                // In locals, which the compiler can keep in registers and vectorise.
+                Bounds box = _emptyBounds();
+                for (unsigned i = first; i < last; i++) {
+                    box.minX = std::min(box.minX, std::min(positionX[i], previousX[i]));
+                    box.maxX = std::max(box.maxX, std::max(positionX[i], previousX[i]));
+                    box.minY = std::min(box.minY, std::min(positionY[i], previousY[i]));
+                    box.maxY = std::max(box.maxY, std::max(positionY[i], previousY[i]));
+                }
+                chunkBounds[first / BOUNDS_CHUNK] = box;
+            }
+        }
+
+        /** Gets the number of chunks holding live particles. */
+        unsigned chunkCount() const {
+            return (count + BOUNDS_CHUNK - 1) / BOUNDS_CHUNK;
+        }
+
+        /**
+         * Gets the drag to apply at each step of the given duration for the
+         * given damping. This is a power, so it should not be computed per
+         * particle per step.
+         */
+        static real dragForStep(real damping, real step) {
+            return real_pow(damping, step);
+        }
+
+        /**
+         * Integrates every live particle of the store forward in time by the
+         * given amount, and decreases their age by the same amount.
+         *
+         * This is the same Newton-Euler integration as Particle::integrate,
+         * run over whole arrays at once. The duration must be the step the
+         * drags were computed for.
+         */
+        void integrate(real duration) {
+            integrate(0, size(), duration);
+        }
+
+        /** Integrates the particles in [begin, end) forward in time. */
+        void integrate(unsigned begin, unsigned end, real duration) {
+            assert(duration > 0.0);
+
+            _integrate(begin, end, duration, acceleration.x, acceleration.y, acceleration.z,
+                       positionX.data(), positionY.data(), positionZ.data(),
+                       previousX.data(), previousY.data(), previousZ.data(),
+                       velocityX.data(), velocityY.data(), velocityZ.data(),
+                       forceX.data(), forceY.data(), forceZ.data(),
+                       drag.data(), inverseMass.data(), age.data());
+        }
+
+        /**
+         * Integrates the particles in [begin, end) with the given
+         * acceleration and drag instead of the shared acceleration and
+         * the per-particle drags. For sets of particles known to share
+         * them, such as the batch of one firework type: the constants
+         * stay in registers instead of being streamed from memory.
+         */
+        void integrateUniform(unsigned begin, unsigned end, real duration, real ax, real ay, real az, real uniformDrag) {
+            assert(duration > 0.0);
+
+            _integrateUniform(begin, end, duration, ax, ay, az, uniformDrag,
+                              positionX.data(), positionY.data(), positionZ.data(),
+                              previousX.data(), previousY.data(), previousZ.data(),
+                              velocityX.data(), velocityY.data(), velocityZ.data(),
+                              forceX.data(), forceY.data(), forceZ.data(),
+                              inverseMass.data(), age.data());
+        }
+
+    private:
+        /** Holds the number of live particles. */
+        unsigned count;
+
+        static Bounds _emptyBounds() {
+            return {REAL_MAX, REAL_MAX, -REAL_MAX, -REAL_MAX};
+        }
+
+        /** Extends the boxes of the chunks of [begin, end) to hold its particles. */
+        void _growChunkBounds(unsigned begin, unsigned end) {
+            for (unsigned i = begin; i < end; i++) {
+                Bounds &box = chunkBounds[i / BOUNDS_CHUNK];
+                box.add(positionX[i], positionY[i]);
+                box.add(previousX[i], previousY[i]);
+            }
+        }
+
+        static uint64_t _hash(uint64_t hash, const void *data, size_t size) {
+            const unsigned char *bytes = static_cast<const unsigned char *>(data);
+            for (size_t i = 0; i < size; i++) {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+            return hash;
+        }
+
+        /**
+         * The integration loop. The arrays never overlap: they are given as
+         * restrict parameters so the compiler can vectorise the loop without
+         * checking every pair of arrays at runtime.
+         */
+        static void _integrate(
+                unsigned begin, unsigned end, real duration, real ax, real ay, real az,
+                real *__restrict px, real *__restrict py, real *__restrict pz,
+                real *__restrict ox, real *__restrict oy, real *__restrict oz,
+                real *__restrict vx, real *__restrict vy, real *__restrict vz,
+                real *__restrict fx, real *__restrict fy, real *__restrict fz,
+                const real *__restrict d, const real *__restrict im, real *__restrict a
+        ) {
+            for (unsigned i = begin; i < end; i++) {
+                // Keep the current position to interpolate from.
+                ox[i] = px[i];
+                oy[i] = py[i];
+                oz[i] = pz[i];
+
+                // Update linear position.
+                px[i] += vx[i] * duration;
+                py[i] += vy[i] * duration;
+                pz[i] += vz[i] * duration;
+
+                // Update linear velocity from the acceleration (a = 1/m * f) and impose drag.
+                vx[i] = (vx[i] + (ax + fx[i] * im[i]) * duration) * d[i];
+                vy[i] = (vy[i] + (ay + fy[i] * im[i]) * duration) * d[i];
+                vz[i] = (vz[i] + (az + fz[i] * im[i]) * duration) * d[i];
+
+                fx[i] = fy[i] = fz[i] = 0;
+
+                a[i] -= duration;
+            }
+        }
+
+        /** The integration loop, with the same drag for every particle. */
+        static void _integrateUniform(
+                unsigned begin, unsigned end, real duration, real ax, real ay, real az, real d,
+                real *__restrict px, real *__restrict py, real *__restrict pz,
+                real *__restrict ox, real *__restrict oy, real *__restrict oz,
+                real *__restrict vx, real *__restrict vy, real *__restrict vz,
+                real *__restrict fx, real *__restrict fy, real *__restrict fz,
+                const real *__restrict im, real *__restrict a
+        ) {
+            for (unsigned i = begin; i < end; i++) {
+                ox[i] = px[i];
+                oy[i] = py[i];
+                oz[i] = pz[i];
+
+                px[i] += vx[i] * duration;
+                py[i] += vy[i] * duration;
+                pz[i] += vz[i] * duration;
+
+                vx[i] = (vx[i] + (ax + fx[i] * im[i]) * duration) * d;
+                vy[i] = (vy[i] + (ay + fy[i] * im[i]) * duration) * d;
+                vz[i] = (vz[i] + (az + fz[i] * im[i]) * duration) * d;
+
+                fx[i] = fy[i] = fz[i] = 0;
+
+                a[i] -= duration;
+            }
+        }
+    };
+}
+
+#endif // PHYGINE_PARTICLE_STORE
@@ -1,91 +1,181 @@
+#ifndef PHYGINE_RANDOM
+#define PHYGINE_RANDOM
+
+#include <stdint.h>
+#include <atomic>
+
 #include "precision.cpp"
 #include "Vector3.cpp"
 
 namespace phygine {
-    /** A particle is the simplest object that can be simulated in the physics system.*/
+    /**
+     * A fast pseudo random number generator (xoshiro128**).
+     *
+     * The generator is fully determined by its seed: the same seed
+     * always gives the same sequence, on every platform. Its state is
+     * four 32 bits words, and one number costs a handful of shifts and
+     * xors, which suits 32 bits ARM as well as 64 bits targets.
+     *
+     * A generator must not be shared between threads. Use local() to
+     * get one per thread, each drawing from its own independent stream.
+     */
     class Random {
     private:
-        // Internal mechanics
-        int p1, p2;
-        unsigned buffer[17];
-
-        void _seed(unsigned s)
-        {
-            if (s == 0) {
-                s = (unsigned)SDL_GetTicks();
-            }
+        uint32_t state[4];
 
-            // Fill the buffer with some basic random numbers
-            for (unsigned i = 0; i < 17; i++)
-            {
-                // Simple linear congruential generator
-                s = s * 2891336453 + 1;
-                buffer[i] = s;
-            }
+        static uint32_t rotl(uint32_t n, unsigned r) {
+            return (n << r) | (n >> (32 - r));
+        }
 
-            // Initialize pointers into the buffer
-            p1 = 0;  p2 = 10;
+        /** Expands a 64 bits seed into well mixed state words (splitmix64). */
+        static uint64_t splitmix(uint64_t &s) {
+            uint64_t z = (s += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            return z ^ (z >> 31);
         }
 
+        /** The number of streams handed over by local() so far. */
+        static std::atomic<unsigned> streamCount;
+
     public:
+        /** The seed used when none is given. */
+        static const uint64_t defaultSeed = 0x5eed5eed5eedull;
+
+        /** The generator of the simulation thread. */
         static Random r;
 
-        Random() {
-            this->_seed(0);
+        explicit Random(uint64_t seed = defaultSeed) {
+            this->seed(seed);
         }
 
-        real randomReal() {
-            // Get the random number
-            unsigned bits = randomBits();
-
-            // Set up a reinterpret structure for manipulation
-            union {
-                real value;
-                unsigned word;
-            } convert;
-
-            // Now assign the bits to the word. This works by fixing the ieee
-            // sign and exponent bits (so that the size of the result is 1-2)
-            // and using the bits to _create the fraction part of the float.
-            convert.word = (bits >> 9) | 0x3f800000;
-
-            // And return the value
-            return convert.value - 1.0f;
+        /** Restarts the sequence from the given seed. */
+        void seed(uint64_t s) {
+            const uint64_t a = splitmix(s);
+            const uint64_t b = splitmix(s);
+            state[0] = (uint32_t) a;
+            state[1] = (uint32_t) (a >> 32);
+            state[2] = (uint32_t) b;
+            state[3] = (uint32_t) (b >> 32);
         }
 
-        Vector3 randomVector(const Vector3 &min, const Vector3 &max)
-        {
-            return {randomReal(min.x, max.x), randomReal(min.y, max.y), randomReal(min.z, max.z)};
+        /**
+         * Advances the generator by 2^64 numbers. Calling it n times on
+         * copies of the same generator gives non overlapping streams.
+         */
+        void jump() {
+            static const uint32_t JUMP[] = {0x8764000b, 0xf542d2d3, 0x6fa035c3, 0x77f2db5b};
+
+            uint32_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+            for (uint32_t word : JUMP) {
+                for (unsigned b = 0; b < 32; b++) {
+                    if (word & (1u << b)) {
+                        s0 ^= state[0];
+                        s1 ^= state[1];
+                        s2 ^= state[2];
+                        s3 ^= state[3];
+                    }
+                    randomBits();
+                }
+            }
+
+            state[0] = s0;
+            state[1] = s1;
+            state[2] = s2;
+            state[3] = s3;
         }
 
-        real randomReal(real min, real max) {
-            return randomReal() * (max - min) + min;
+        /**
+         * Gets the generator of the given stream of the given seed, that is
+         * the seeded generator jumped stream times.
+         */
+        static Random forStream(uint64_t seed, unsigned stream) {
+            Random random(seed);
+            for (unsigned i = 0; i < stream; i++) {
+                random.jump();
+            }
+            return random;
         }
 
-        unsigned randomInt(unsigned max) {
-            return rand() % max;
+        /**
+         * Gets the generator of the calling thread. Each thread gets its own
+         * stream of the default seed, in the order they first call this.
+         */
+        static Random &local() {
+            thread_local Random random = forStream(defaultSeed, 1 + streamCount.fetch_add(1));
+            return random;
+        }
+
+        uint32_t randomBits() {
+            const uint32_t result = rotl(state[1] * 5, 7) * 9;
+            const uint32_t t = state[1] << 9;
+
+            state[2] ^= state[0];
+            state[3] ^= state[1];
+            state[1] ^= state[2];
+            state[0] ^= state[3];
+            state[2] ^= t;
+            state[3] = rotl(state[3], 11);
+
+            return result;
         }
 
-        unsigned rotl(unsigned n, unsigned ri) {
-            return (n << ri) | (n >> (32 - ri));
+        /** Gets a random real in [0, 1). */
+        real randomReal() {
+#ifdef PHYGINE_FIXED_POINT
+            // The 16 high bits fill the whole fraction.
+            return real::fromRaw((int32_t) (randomBits() >> 16));
+#else
+            // The 24 high bits fill the whole mantissa of a float.
+            return real((randomBits() >> 8) * (1.0f / 16777216.0f));
+#endif
         }
 
-        unsigned randomBits() {
-            _seed(0);
+        /** Gets a random real in [min, max). */
+        real randomReal(real min, real max) {
+            return randomReal() * (max - min) + min;
+        }
+
+        Vector3 randomVector(const Vector3 &min, const Vector3 &max) {
+            return {randomReal(min.x, max.x), randomReal(min.y, max.y), randomReal(min.z, max.z)};
+        }
 
-            unsigned result;
+        /** Gets a random integer in [0, max), without any division. */
+        unsigned randomInt(unsigned max) {
+            return (unsigned) (((uint64_t) randomBits() * max) >> 32);
+        }
 
-            // Rotate the buffer and store it back to itself
-            result = buffer[p1] = rotl(buffer[p2], 13) + rotl(buffer[p1], 9);
+        /** Fills the given array with random reals in [min, max). */
+        void fillReals(real *out, unsigned count, real min, real max) {
+            // Work on a copy, so that the state stays in registers rather
+            // than being reloaded after every write to the array.
+            Random generator(*this);
+            const real range = max - min;
+            for (unsigned i = 0; i < count; i++) {
+                out[i] = generator.randomReal() * range + min;
+            }
+            *this = generator;
+        }
 
-            // Rotate pointers
-            if (--p1 < 0) p1 = 16;
-            if (--p2 < 0) p2 = 16;
+        /** Fills the given array with random integers in [0, max). */
+        void fillInts(unsigned *out, unsigned count, unsigned max) {
+            Random generator(*this);
+            for (unsigned i = 0; i < count; i++) {
+                out[i] = generator.randomInt(max);
+            }
+            *this = generator;
+        }
 
-            // Return result
-            return result;
+        /** Fills the given array with random vectors, component-wise in [min, max). */
+        void fillVectors(Vector3 *out, unsigned count, const Vector3 &min, const Vector3 &max) {
+            for (unsigned i = 0; i < count; i++) {
+                out[i] = randomVector(min, max);
+            }
         }
     };
 
+    std::atomic<unsigned> Random::streamCount{0};
     Random Random::r = Random();
-}
\ No newline at end of file
+}
+
+#endif // PHYGINE_RANDOM
@@ -0,0 +1,224 @@
+#ifndef PHYGINE_SPATIAL_GRID
+#define PHYGINE_SPATIAL_GRID
+
+#include <algorithm>
+#include <vector>
+
+#include "precision.cpp"
+#include "ParticleStore.cpp"
+
+namespace phygine {
+    /**
+     * A uniform grid over the x and y of a set of particles, to find
+     * the particles near a point without looking at all of them.
+     *
+     * The grid covers fixed bounds, cut in square cells. Particles out
+     * of the bounds are kept in the border cells, so queries stay exact
+     * anywhere, only slower far outside.
+     *
+     * The grid is not updated as particles move: it is rebuilt from
+     * scratch (build) after each step, with a counting sort. After the
+     * build, the particles of each cell are contiguous, along with a copy
+     * of their positions, so a query reads memory in order.
+     */
+    class SpatialGrid {
+    public:
+        /** A range of the sorted arrays: the particles of one cell. */
+        struct Range {
+            unsigned begin;
+            unsigned end;
+        };
+
+        /**
+         * Creates a grid over [minX, maxX] x [minY, maxY], with cells of
+         * the given size. Queries are the fastest when the cell size is
+         * about their radius.
+         */
+        SpatialGrid(real minX, real minY, real maxX, real maxY, real cellSize) {
+            setBounds(minX, minY, maxX, maxY, cellSize);
+        }
+
+        /** Changes the bounds and the cell size. Takes effect at the next build. */
+        void setBounds(real minX, real minY, real maxX, real maxY, real cellSize) {
+            this->minX = minX;
+            this->minY = minY;
+            this->inverseCellSize = 1 / cellSize;
+            this->columns = _cellCount(maxX - minX, cellSize);
+            this->rows = _cellCount(maxY - minY, cellSize);
+            this->cellStart.assign(columns * rows + 1, 0);
+        }
+
+        /**
+         * Allocates the room to index the given number of particles, so
+         * that build() does not allocate up to that number.
+         */
+        void reserve(unsigned count) {
+            cellOf.reserve(count);
+            indices.reserve(count);
+            sortedX.reserve(count);
+            sortedY.reserve(count);
+            cursor.reserve(cellStart.size());
+        }
+
+        /** Indexes the live particles of the given store. */
+        void build(const ParticleStore &store) {
+            build(store.positionX.data(), store.positionY.data(), store.size());
+        }
+
+        /**
+         * Indexes the given positions. The particle i is at (x[i], y[i]).
+         * Does not allocate once the grid has held as many particles.
+         */
+        void build(const real *x, const real *y, unsigned count) {
+            const unsigned cells = columns * rows;
+            cellOf.resize(count);
+            indices.resize(count);
+            sortedX.resize(count);
+            sortedY.resize(count);
+
+            // Count the particles of each cell, shifted by one...
+            std::fill(cellStart.begin(), cellStart.end(), 0);
+            for (unsigned i = 0; i < count; i++) {
+                const unsigned cell = _column(x[i]) + _row(y[i]) * columns;
+                cellOf[i] = cell;
+                cellStart[cell + 1]++;
+            }
+
+            // ... so that their prefix sum gives where each cell starts.
+            for (unsigned cell = 0; cell < cells; cell++) {
+                cellStart[cell + 1] += cellStart[cell];
+            }
+
+            // Scatter the particles, in index order within each cell.
+            cursor.assign(cellStart.begin(), cellStart.end() - 1);
+            for (unsigned i = 0; i < count; i++) {
+                const unsigned slot = cursor[cellOf[i]]++;
+                indices[slot] = i;
+                sortedX[slot] = x[i];
+                sortedY[slot] = y[i];
+            }
+        }
+
+        /**
+         * Calls visit(index) for every particle in the given box, bounds
+         * included.
+         */
+        template<typename Visit>
+        void queryBox(real boxMinX, real boxMinY, real boxMaxX, real boxMaxY, Visit visit) const {
+            const unsigned firstColumn = _column(boxMinX), lastColumn = _column(boxMaxX);
+            const unsigned firstRow = _row(boxMinY), lastRow = _row(boxMaxY);
+
+            for (unsigned row = firstRow; row <= lastRow; row++) {
+                // The cells of a row are contiguous in the sorted arrays.
+                const unsigned end = cellStart[row * columns + lastColumn + 1];
+                for (unsigned k = cellStart[row * columns + firstColumn]; k < end; k++) {
+                    if (sortedX[k] >= boxMinX && sortedX[k] <= boxMaxX && sortedY[k] >= boxMinY && sortedY[k] <= boxMaxY) {
+                        visit(indices[k]);
+                    }
+                }
+            }
+        }
+
+        /**
+         * Calls visit(index, squareDistance) for every particle within the
+         * given radius of (x, y).
+         */
+        template<typename Visit>
+        void queryRadius(real x, real y, real radius, Visit visit) const {
+            const real squareRadius = radius * radius;
+            const unsigned firstColumn = _column(x - radius), lastColumn = _column(x + radius);
+            const unsigned firstRow = _row(y - radius), lastRow = _row(y + radius);
+
+            for (unsigned row = firstRow; row <= lastRow; row++) {
+                const unsigned end = cellStart[row * columns + lastColumn + 1];
+                for (unsigned k = cellStart[row * columns + firstColumn]; k < end; k++) {
+                    const real dx = sortedX[k] - x;
+                    const real dy = sortedY[k] - y;
+                    const real squareDistance = dx * dx + dy * dy;
+                    if (squareDistance <= squareRadius) {
+                        visit(indices[k], squareDistance);
+                    }
+                }
+            }
+        }
+
+        /** Appends the index of every particle within the given radius of (x, y). */
+        void queryRadius(real x, real y, real radius, std::vector<unsigned> &out) const {
+            queryRadius(x, y, radius, [&out](unsigned index, real) { out.push_back(index); });
+        }
+
+        /** Gets the cell of the given point, clamped to the grid. */
+        unsigned cellAt(real x, real y) const {
+            return _column(x) + _row(y) * columns;
+        }
+
+        /**
+         * Gets where the particles of the given cell are in the sorted
+         * arrays (getIndices, getSortedX, getSortedY).
+         */
+        Range cellRange(unsigned cell) const {
+            return {cellStart[cell], cellStart[cell + 1]};
+        }
+
+        unsigned getColumns() const {
+            return columns;
+        }
+
+        unsigned getRows() const {
+            return rows;
+        }
+
+        /** The particle indices, sorted by cell. */
+        const unsigned *getIndices() const {
+            return indices.data();
+        }
+
+        const real *getSortedX() const {
+            return sortedX.data();
+        }
+
+        const real *getSortedY() const {
+            return sortedY.data();
+        }
+
+    private:
+        real minX = 0;
+        real minY = 0;
+        real inverseCellSize = 1;
+        unsigned columns = 1;
+        unsigned rows = 1;
+
+        /** Where each cell starts in the sorted arrays, plus the total count at the end. */
+        std::vector<unsigned> cellStart;
+
+        /** Build scratch: the cell of each particle, and where the next one of each cell goes. */
+        std::vector<unsigned> cellOf;
+        std::vector<unsigned> cursor;
+
+        /** The particles sorted by cell: their index, and a copy of their position. */
+        std::vector<unsigned> indices;
+        std::vector<real> sortedX;
+        std::vector<real> sortedY;
+
+        static unsigned _cellCount(real extent, real cellSize) {
+            const real count = extent / cellSize;
+            return count < 1 ? 1 : (unsigned) count + 1;
+        }
+
+        static unsigned _clamp(real cell, unsigned count) {
+            // Also catches NaN, which fails every comparison.
+            if (!(cell >= 0)) return 0;
+            return cell >= count ? count - 1 : (unsigned) cell;
+        }
+
+        unsigned _column(real x) const {
+            return _clamp((x - minX) * inverseCellSize, columns);
+        }
+
+        unsigned _row(real y) const {
+            return _clamp((y - minY) * inverseCellSize, rows);
+        }
+    };
+}
+
+#endif // PHYGINE_SPATIAL_GRID
@@ -1,14 +1,36 @@
 #ifndef PHYGINE_VECTOR3_H
 #define PHYGINE_VECTOR3_H
 
+#include <iostream>
+
 #include "precision.cpp"
 
-namespace phygine {
-    class Vector3 {
-    private:
-        /** Padding to ensure 4 word alignment. */
-        real pad;
+/**
+ * Vector3 uses 4 wide SIMD instructions when the target has them, unless
+ * PHYGINE_NO_SIMD is defined. x86 Android ABIs all have SSE, and the NDK
+ * builds armeabi-v7a and arm64-v8a with NEON. The lanes are floats: fixed
+ * point reals always use the plain code.
+ */
+#if defined(PHYGINE_FIXED_POINT) && !defined(PHYGINE_NO_SIMD)
+#define PHYGINE_NO_SIMD
+#endif
+
+#if !defined(PHYGINE_NO_SIMD) && (defined(__SSE__) || defined(_M_X64))
+#define PHYGINE_SIMD_SSE
+#include <xmmintrin.h>
+#elif !defined(PHYGINE_NO_SIMD) && defined(__ARM_NEON)
+#define PHYGINE_SIMD_NEON
+#include <arm_neon.h>
+#endif
 
+namespace phygine {
+    /**
+     * A vector of three reals, padded to four so that the whole vector
+     * fits a 16 bytes SIMD register. The padding lane is always zero, so
+     * it can take part in the 4 wide operations without changing their
+     * results.
+     */
+    class alignas(16) Vector3 {
     public:
         /** Holds the value along the x axis. */
         real x;
@@ -19,15 +41,66 @@ namespace phygine {
         /** Holds the value along the z axis. */
         real z;
 
+    private:
+        /** Padding to ensure 4 word alignment. Always zero. */
+        real pad;
+
+#if defined(PHYGINE_SIMD_SSE)
+        typedef __m128 Lanes;
+
+        /** Loads the four lanes. The vector may not be aligned if heap allocated before C++17. */
+        Lanes load() const { return _mm_loadu_ps(&x); }
+        void store(Lanes v) { _mm_storeu_ps(&x, v); }
+        static Lanes splat(real value) { return _mm_set1_ps(value); }
+        static Lanes add(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+        static Lanes sub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+        static Lanes mul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+
+        /** Sums the four lanes. */
+        static real sum(Lanes v) {
+            Lanes shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+            Lanes sums = _mm_add_ps(v, shuffled);
+            shuffled = _mm_movehl_ps(shuffled, sums);
+            return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+        }
+#elif defined(PHYGINE_SIMD_NEON)
+        typedef float32x4_t Lanes;
+
+        Lanes load() const { return vld1q_f32(&x); }
+        void store(Lanes v) { vst1q_f32(&x, v); }
+        static Lanes splat(real value) { return vdupq_n_f32(value); }
+        static Lanes add(Lanes a, Lanes b) { return vaddq_f32(a, b); }
+        static Lanes sub(Lanes a, Lanes b) { return vsubq_f32(a, b); }
+        static Lanes mul(Lanes a, Lanes b) { return vmulq_f32(a, b); }
+
+        /** Sums the four lanes. */
+        static real sum(Lanes v) {
+#if defined(__aarch64__)
+            return vaddvq_f32(v);
+#else
+            float32x2_t half = vadd_f32(vget_low_f32(v), vget_high_f32(v));
+            return vget_lane_f32(vpadd_f32(half, half), 0);
+#endif
+        }
+#endif
+
+#if defined(PHYGINE_SIMD_SSE) || defined(PHYGINE_SIMD_NEON)
+#define PHYGINE_SIMD
+        explicit Vector3(Lanes v) {
+            store(v);
+        }
+#endif
+
+    public:
         /** The default constructor creates a zero vector. */
-        Vector3() : x(0), y(0), z(0) {}
+        Vector3() : x(0), y(0), z(0), pad(0) {}
 
         /**
          * The explicit constructor creates a vector with the given
          * components.
          */
         Vector3(const real x, const real y, const real z)
-                : x(x), y(y), z(z) {}
+                : x(x), y(y), z(z), pad(0) {}
 
         const static Vector3 GRAVITY;
 
@@ -49,42 +122,66 @@ namespace phygine {
 
         /** Adds the given vector to this. */
         void operator+=(const Vector3 &v) {
+#ifdef PHYGINE_SIMD
+            store(add(load(), v.load()));
+#else
             x += v.x;
             y += v.y;
             z += v.z;
+#endif
         }
 
         /**
          * Returns the value of the given vector added to this.
          */
         Vector3 operator+(const Vector3 &v) const {
+#ifdef PHYGINE_SIMD
+            return Vector3(add(load(), v.load()));
+#else
             return {x + v.x, y + v.y, z + v.z};
+#endif
         }
 
         /** Subtracts the given vector from this. */
         void operator-=(const Vector3 &v) {
+#ifdef PHYGINE_SIMD
+            store(sub(load(), v.load()));
+#else
             x -= v.x;
             y -= v.y;
             z -= v.z;
+#endif
         }
 
         /**
          * Returns the value of the given vector subtracted from this.
          */
         Vector3 operator-(const Vector3 &v) const {
+#ifdef PHYGINE_SIMD
+            return Vector3(sub(load(), v.load()));
+#else
             return {x - v.x, y - v.y, z - v.z};
+#endif
         }
 
         /** Multiplies this vector by the given scalar. */
         void operator*=(const real value) {
+#ifdef PHYGINE_SIMD
+            store(mul(load(), splat(value)));
+#else
             x *= value;
             y *= value;
             z *= value;
+#endif
         }
 
         /** Returns a copy of this vector scaled the given value. */
         Vector3 operator*(const real value) const {
+#ifdef PHYGINE_SIMD
+            return Vector3(mul(load(), splat(value)));
+#else
             return Vector3(x * value, y * value, z * value);
+#endif
         }
 
         /**
@@ -92,7 +189,11 @@ namespace phygine {
          * vector with the given vector.
          */
         Vector3 componentProduct(const Vector3 &vector) const {
+#ifdef PHYGINE_SIMD
+            return Vector3(mul(load(), vector.load()));
+#else
             return Vector3(x * vector.x, y * vector.y, z * vector.z);
+#endif
         }
 
         /**
@@ -100,9 +201,13 @@ namespace phygine {
          * sets this vector to its result.
          */
         void componentProductUpdate(const Vector3 &vector) {
+#ifdef PHYGINE_SIMD
+            store(mul(load(), vector.load()));
+#else
             x *= vector.x;
             y *= vector.y;
             z *= vector.z;
+#endif
         }
 
         /**
@@ -138,7 +243,11 @@ namespace phygine {
          * with the given vector.
          */
         real scalarProduct(const Vector3 &vector) const {
+#ifdef PHYGINE_SIMD
+            return sum(mul(load(), vector.load()));
+#else
             return x * vector.x + y * vector.y + z * vector.z;
+#endif
         }
 
         /**
@@ -146,35 +255,37 @@ namespace phygine {
          * with the given vector.
          */
         real operator*(const Vector3 &vector) const {
-            return x * vector.x + y * vector.y + z * vector.z;
+            return scalarProduct(vector);
         }
 
         /**
          * Adds the given vector to this, scaled by the given amount.
          */
         void addScaledVector(const Vector3 &vector, real scale) {
+#ifdef PHYGINE_SIMD
+            store(add(load(), mul(vector.load(), splat(scale))));
+#else
             x += vector.x * scale;
             y += vector.y * scale;
             z += vector.z * scale;
+#endif
         }
 
         /** Gets the magnitude of this vector. */
         real magnitude() const {
-            return real_sqrt(x * x + y * y + z * z);
+            return real_sqrt(squareMagnitude());
         }
 
         /** Gets the squared magnitude of this vector. */
         real squareMagnitude() const {
-            return x * x + y * y + z * z;
+            return scalarProduct(*this);
         }
 
         /** Limits the size of the vector to the given maximum. */
         void trim(real size) {
             if (squareMagnitude() > size * size) {
                 normalise();
-                x *= size;
-                y *= size;
-                z *= size;
+                (*this) *= size;
             }
         }
 
@@ -1,15 +1,44 @@
+#ifndef PHYGINE_PRECISION
+#define PHYGINE_PRECISION
+
+#include <float.h>
 #include <math.h>
 
+/**
+ * Build with PHYGINE_FIXED_POINT defined to simulate with Q16.16 fixed-point
+ * reals rather than floats: the simulation then gives the same results bit
+ * for bit on every ABI, for lockstep and replays. Slower, and with a much
+ * smaller range, see Fixed.
+ */
+#ifdef PHYGINE_FIXED_POINT
+#include "Fixed.cpp"
+#endif
+
 namespace phygine {
+#ifdef PHYGINE_FIXED_POINT
+    typedef Fixed real;
+
+#define REAL_MAX Fixed::max()
+
+#define real_sqrt fixedSqrt
+
+#define real_pow fixedPow
+#else
     /**
     * Define a real type to allow the engine to be rapidly compiled in different precisions if we
     * event need to later.
     */
     typedef float real;
 
+    /** Defines the highest value for the real number. */
+#define REAL_MAX FLT_MAX
+
     /** Defines the precision of the square root operator. */
 #define real_sqrt sqrtf
 
     /** Defines the precision of the power operator. */
 #define real_pow powf
-}
\ No newline at end of file
+#endif
+}
+
+#endif // PHYGINE_PRECISION
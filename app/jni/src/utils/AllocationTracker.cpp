@@ -0,0 +1,234 @@
+#ifndef ALLOCATION_TRACKER_CPP
+#define ALLOCATION_TRACKER_CPP
+
+#include <assert.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+#include <SDL.h>
+
+#include "Profiler.cpp"
+
+/**
+ * Counts the heap allocations per frame, and per profiler scope (see PROFILE_SCOPE), to check that
+ * the game loop does not allocate once warmed up. The allocator takes locks and sometimes goes to
+ * the system, which shows up in the tails of the frame time.
+ *
+ * Only counts with TRACK_ALLOCATIONS defined, which replaces the global operator new and delete.
+ * They must then be defined once in the program: the game is a single translation unit, loop.cpp.
+ * Without it, every count stays at zero.
+ *
+ * Allocations from any thread are counted, attributed to the innermost scope open on their thread.
+ * Once the game loop thread is known (setLoopThread), those of the other threads (asset loader,
+ * jobs, simulation thread) go in a bucket of their own: reported, but not asserted on, since their
+ * work does not follow the frames.
+ */
+class AllocationTracker {
+public:
+    /** Index of the allocations made out of any scope. */
+    const static unsigned NO_SCOPE = Profiler::NO_SCOPE;
+
+    static AllocationTracker &getInstance() {
+        // Constant initialised, so it can be used by operator new before main.
+        static AllocationTracker instance;
+        return instance;
+    }
+
+    AllocationTracker(AllocationTracker const &) = delete;
+    void operator=(AllocationTracker const &) = delete;
+
+    static constexpr bool enabled() {
+#ifdef TRACK_ALLOCATIONS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /** Count an allocation. Called by operator new: must not allocate. */
+    void count(size_t size) {
+        const unsigned scope = Profiler::currentScope();
+        const unsigned bucket = !loopThreadSet.load(std::memory_order_relaxed) || _onLoopThread() ? LOOP : OTHERS;
+        perScope[bucket][scope < NO_SCOPE ? scope : NO_SCOPE].fetch_add(1, std::memory_order_relaxed);
+        frameBytes[bucket].fetch_add(size, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /**
+     * Make the calling thread the game loop one: from then on, only its allocations are checked in
+     * the steady state. Until it is called, those of every thread are.
+     */
+    void setLoopThread() {
+        _onLoopThread() = true;
+        loopThreadSet.store(true, std::memory_order_relaxed);
+    }
+
+    /**
+     * From the next frame on, every frame should do no allocation on the game loop thread. Those
+     * that do are logged with their scopes, and fail an assert in debug builds. Allocations on the
+     * other threads are only logged.
+     */
+    void expectSteadyState(bool steady = true) {
+        steadyState = steady;
+    }
+
+    /**
+     * Close the current frame, and start counting the next one.
+     *
+     * @return the number of allocations of the frame on the game loop thread.
+     */
+    unsigned long long endFrame() {
+        unsigned long long scopes[BUCKETS][NO_SCOPE + 1];
+        unsigned long long allocations[BUCKETS] = {};
+        unsigned long long bytes[BUCKETS];
+        for (unsigned bucket = 0; bucket < BUCKETS; bucket++) {
+            for (unsigned i = 0; i <= NO_SCOPE; i++) {
+                scopes[bucket][i] = perScope[bucket][i].exchange(0, std::memory_order_relaxed);
+                allocations[bucket] += scopes[bucket][i];
+            }
+            bytes[bucket] = frameBytes[bucket].exchange(0, std::memory_order_relaxed);
+        }
+        frames++;
+        otherThreadAllocations = allocations[OTHERS];
+
+        if (steadyState && allocations[OTHERS] > 0) {
+            SDL_Log("Frame %llu: %llu heap allocations (%llu bytes) on other threads:\n", frames, allocations[OTHERS], bytes[OTHERS]);
+            _logScopes(scopes[OTHERS]);
+        }
+        if (allocations[LOOP] == 0) return 0;
+
+        framesWithAllocations++;
+        if (steadyState) {
+            SDL_Log("Frame %llu did %llu heap allocations (%llu bytes) in the steady state:\n", frames, allocations[LOOP], bytes[LOOP]);
+            _logScopes(scopes[LOOP]);
+            assert(!"The steady state game loop must not allocate");
+        }
+        return allocations[LOOP];
+    }
+
+    /** Number of allocations made on the other threads than the game loop one, in the last frame. */
+    unsigned long long getOtherThreadAllocations() const {
+        return otherThreadAllocations;
+    }
+
+    /** Number of allocations since the start. */
+    unsigned long long getTotal() const {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    /** Number of frames that allocated on the game loop thread, steady or not. */
+    unsigned long long getFramesWithAllocations() const {
+        return framesWithAllocations;
+    }
+
+private:
+    /** The counts of the game loop thread, and of all the others. */
+    enum Bucket { LOOP, OTHERS, BUCKETS };
+
+    std::atomic<unsigned long long> perScope[BUCKETS][NO_SCOPE + 1] = {};
+    std::atomic<unsigned long long> frameBytes[BUCKETS] = {};
+    std::atomic<unsigned long long> total{0};
+    std::atomic<bool> loopThreadSet{false};
+    unsigned long long frames = 0;
+    unsigned long long framesWithAllocations = 0;
+    unsigned long long otherThreadAllocations = 0;
+    bool steadyState = false;
+
+    constexpr AllocationTracker() = default;
+
+    static bool &_onLoopThread() {
+        static thread_local bool loopThread = false;
+        return loopThread;
+    }
+
+    static void _logScopes(const unsigned long long *scopes) {
+        const Profiler &profiler = Profiler::getInstance();
+        for (unsigned i = 0; i <= NO_SCOPE; i++) {
+            if (scopes[i] == 0) continue;
+            SDL_Log("  %s: %llu\n", i < profiler.getScopeCount() ? profiler.scopeName(i) : "(no scope)", scopes[i]);
+        }
+    }
+};
+
+#ifdef TRACK_ALLOCATIONS
+/*
+ * The replaced allocation functions. They do not throw: like the NDK without exceptions, running
+ * out of memory aborts.
+ */
+inline void *trackedAllocate(size_t size) {
+    AllocationTracker::getInstance().count(size);
+    void *memory = malloc(size > 0 ? size : 1);
+    if (memory == nullptr) abort();
+    return memory;
+}
+
+void *operator new(size_t size) {
+    return trackedAllocate(size);
+}
+
+void *operator new[](size_t size) {
+    return trackedAllocate(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    return trackedAllocate(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return trackedAllocate(size);
+}
+
+void operator delete(void *memory) noexcept {
+    free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+    free(memory);
+}
+
+void operator delete(void *memory, size_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void *memory, size_t) noexcept {
+    free(memory);
+}
+
+#ifdef __cpp_aligned_new
+inline void *trackedAllocateAligned(size_t size, std::align_val_t alignment) {
+    AllocationTracker::getInstance().count(size);
+    // posix_memalign rather than aligned_alloc, which Android only has from API 28.
+    void *memory = nullptr;
+    const size_t align = (size_t) alignment < sizeof(void *) ? sizeof(void *) : (size_t) alignment;
+    if (posix_memalign(&memory, align, size > 0 ? size : 1) != 0) abort();
+    return memory;
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    return trackedAllocateAligned(size, alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return trackedAllocateAligned(size, alignment);
+}
+
+void operator delete(void *memory, std::align_val_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void *memory, std::align_val_t) noexcept {
+    free(memory);
+}
+
+void operator delete(void *memory, size_t, std::align_val_t) noexcept {
+    free(memory);
+}
+
+void operator delete[](void *memory, size_t, std::align_val_t) noexcept {
+    free(memory);
+}
+#endif
+#endif // TRACK_ALLOCATIONS
+
+#endif // ALLOCATION_TRACKER_CPP
@@ -0,0 +1,358 @@
+#ifndef ASYNC_LOADER_CPP
+#define ASYNC_LOADER_CPP
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <SDL.h>
+#include <SDL_image.h>
+
+#include "TextureCache.cpp"
+
+/**
+ * Loads images without stalling the frame loop.
+ *
+ * Worker threads read and decode the files into surfaces, already converted to the usual texture
+ * format. The upload to the renderer must happen on the main thread: update() does it, a few
+ * images per frame, within a time budget. The textures end up in the TextureCache, so an image
+ * already loaded is ready at once, and one asked twice is loaded once.
+ *
+ * Requests are served highest priority first, in the order they were made within a priority.
+ * load() returns a handle to follow the request, read its texture once ready, or cancel it. The
+ * loads of the same image share one request, which is only cancelled once all of them are.
+ */
+class AsyncLoader {
+public:
+    enum Status {
+        QUEUED,
+        DECODING,
+        DECODED,
+        READY,
+        FAILED,
+        CANCELLED
+    };
+
+private:
+    /** The state of a request, shared by its handles and the loader. */
+    struct Request {
+        std::string path;
+        int priority;
+        unsigned long long sequence;
+        std::atomic<int> status{QUEUED};
+        /** Written by the worker, read by the main thread once DECODED. */
+        SDL_Surface *surface = nullptr;
+        /** Main thread only. */
+        TextureHandle texture;
+        /** Number of load() calls for it not cancelled yet. Main thread only. */
+        unsigned interested = 1;
+    };
+
+    /** One load() call: its request, and whether it was cancelled. Main thread only. */
+    struct Interest {
+        explicit Interest(std::shared_ptr<Request> request) : request(std::move(request)) {}
+
+        std::shared_ptr<Request> request;
+        bool cancelled = false;
+    };
+
+public:
+    /** Follows a request. Main thread only, like the textures. */
+    class Handle {
+    public:
+        Handle() = default;
+
+        Status status() const {
+            if (!interest) return FAILED;
+            if (interest->cancelled) return CANCELLED;
+            return (Status) interest->request->status.load(std::memory_order_acquire);
+        }
+
+        bool ready() const {
+            return status() == READY;
+        }
+
+        /** Whether nothing more will happen to the request: ready, failed or cancelled. */
+        bool done() const {
+            const Status s = status();
+            return s == READY || s == FAILED || s == CANCELLED;
+        }
+
+        /** The texture, empty until ready. */
+        TextureHandle texture() const {
+            return interest && !interest->cancelled ? interest->request->texture : TextureHandle();
+        }
+
+        /**
+         * Give up this load, which then reads as cancelled, as do the copies of this handle. The
+         * request itself is only cancelled, unless already uploaded, when every load() of the
+         * same image is: the others still get their texture.
+         */
+        void cancel() {
+            if (!interest || interest->cancelled) return;
+
+            interest->cancelled = true;
+            Request *request = interest->request.get();
+            if (--request->interested > 0) return;
+
+            int expected = QUEUED;
+            if (!request->status.compare_exchange_strong(expected, CANCELLED)) {
+                // Being decoded or decoded: the loader drops the surface when it sees it.
+                expected = DECODING;
+                if (!request->status.compare_exchange_strong(expected, CANCELLED)) {
+                    expected = DECODED;
+                    request->status.compare_exchange_strong(expected, CANCELLED);
+                }
+            }
+        }
+
+        explicit operator bool() const {
+            return interest != nullptr;
+        }
+
+    private:
+        friend class AsyncLoader;
+
+        explicit Handle(std::shared_ptr<Request> request) : interest(std::make_shared<Interest>(std::move(request))) {}
+
+        std::shared_ptr<Interest> interest;
+    };
+
+    /** @param workerCount: number of decoding threads. */
+    explicit AsyncLoader(unsigned workerCount = 1) {
+        for (unsigned i = 0; i < workerCount; i++) {
+            workers.emplace_back(&AsyncLoader::_work, this);
+        }
+    }
+
+    ~AsyncLoader() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+
+        // The surfaces decoded but never uploaded.
+        for (auto &pair : inFlight) {
+            if (pair.second->surface) SDL_FreeSurface(pair.second->surface);
+        }
+    }
+
+    AsyncLoader(AsyncLoader const &) = delete;
+    void operator=(AsyncLoader const &) = delete;
+
+    /**
+     * Ask for the given image. The higher the priority, the sooner it is decoded and uploaded.
+     * Asking again for an image being loaded shares the same request, with the highest of the
+     * two priorities, but each handle is cancelled on its own. Main thread only.
+     */
+    Handle load(const std::string &path, int priority = 0) {
+        TextureCache &cache = TextureCache::getInstance();
+
+        std::shared_ptr<Request> request;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            auto found = inFlight.find(path);
+            if (found != inFlight.end() && found->second->status.load() != CANCELLED) {
+                if (priority > found->second->priority) found->second->priority = priority;
+                found->second->interested++;
+                return Handle(found->second);
+            }
+
+            request = std::make_shared<Request>();
+            request->path = path;
+            request->priority = priority;
+            request->sequence = nextSequence++;
+
+            if (cache.contains(path)) {
+                // Already uploaded: only take a reference.
+                request->texture = cache.acquire(nullptr, path);
+                request->status = READY;
+                return Handle(request);
+            }
+
+            inFlight[path] = request;
+            queue.push_back(request);
+        }
+        wakeUp.notify_one();
+        return Handle(request);
+    }
+
+    /**
+     * Upload the decoded images to the renderer, highest priority first, until the given time
+     * budget is spent. One image is uploaded anyway, so that loading always progresses.
+     * Call it once per frame, from the main thread.
+     *
+     * @return the number of images uploaded.
+     */
+    unsigned update(SDL_Renderer *renderer, double budgetMs) {
+        const Uint64 start = SDL_GetPerformanceCounter();
+        const Uint64 budget = (Uint64) (budgetMs * SDL_GetPerformanceFrequency() / 1000);
+        unsigned uploaded = 0;
+
+        while (uploaded == 0 || SDL_GetPerformanceCounter() - start < budget) {
+            std::shared_ptr<Request> request = _takeDecoded();
+            if (!request) break;
+
+            SDL_Surface *surface = request->surface;
+            request->surface = nullptr;
+
+            int expected = DECODED;
+            if (surface == nullptr) {
+                request->status.compare_exchange_strong(expected, FAILED);
+                continue;
+            }
+
+            SDL_Texture *texture = nullptr;
+            if (request->status.load() == DECODED) {
+                texture = SDL_CreateTextureFromSurface(renderer, surface);
+                if (texture == nullptr) {
+                    SDL_Log("Could not create the texture of %s: %s\n", request->path.c_str(), SDL_GetError());
+                }
+            }
+
+            if (texture != nullptr) {
+                request->texture = TextureCache::getInstance().adopt(request->path, texture, surface->w, surface->h);
+                // A cancel may have come in the meantime: the texture is kept, as it is in the cache anyway.
+                request->status.store(READY, std::memory_order_release);
+                uploaded++;
+            } else {
+                request->status.compare_exchange_strong(expected, FAILED);
+            }
+            SDL_FreeSurface(surface);
+        }
+
+        return uploaded;
+    }
+
+    /** Number of requests not done yet. */
+    unsigned pending() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return static_cast<unsigned>(inFlight.size());
+    }
+
+private:
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    bool stopping = false;
+    unsigned long long nextSequence = 0;
+
+    /** Every request not finished yet, by path. */
+    std::unordered_map<std::string, std::shared_ptr<Request>> inFlight;
+    /** The requests waiting for a worker, and those waiting for an upload. */
+    std::vector<std::shared_ptr<Request>> queue;
+    std::vector<std::shared_ptr<Request>> decoded;
+
+    /** Whether a should be served before b. */
+    static bool _before(const std::shared_ptr<Request> &a, const std::shared_ptr<Request> &b) {
+        if (a->priority != b->priority) return a->priority > b->priority;
+        return a->sequence < b->sequence;
+    }
+
+    /**
+     * Remove and return the first request of the list to serve, dropping the cancelled ones on
+     * the way. Must be called with the lock held.
+     */
+    std::shared_ptr<Request> _takeFirst(std::vector<std::shared_ptr<Request>> &list) {
+        std::shared_ptr<Request> first;
+        size_t firstIndex = 0;
+
+        // The lists are short, a linear search does it, and lets priorities change in place.
+        for (size_t i = 0; i < list.size();) {
+            if (list[i]->status.load() == CANCELLED) {
+                _forget(list[i]);
+                list[i] = list.back();
+                list.pop_back();
+                continue;
+            }
+            if (!first || _before(list[i], first)) {
+                first = list[i];
+                firstIndex = i;
+            }
+            i++;
+        }
+
+        if (first) {
+            list[firstIndex] = list.back();
+            list.pop_back();
+        }
+        return first;
+    }
+
+    /** Drop a finished or cancelled request from the in-flight ones. Lock held. */
+    void _forget(const std::shared_ptr<Request> &request) {
+        if (request->surface) {
+            SDL_FreeSurface(request->surface);
+            request->surface = nullptr;
+        }
+        auto found = inFlight.find(request->path);
+        if (found != inFlight.end() && found->second == request) {
+            inFlight.erase(found);
+        }
+    }
+
+    std::shared_ptr<Request> _takeDecoded() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<Request> request = _takeFirst(decoded);
+        if (request) {
+            auto found = inFlight.find(request->path);
+            if (found != inFlight.end() && found->second == request) inFlight.erase(found);
+        }
+        return request;
+    }
+
+    void _work() {
+        while (true) {
+            std::shared_ptr<Request> request;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeUp.wait(lock, [this]() { return stopping || !queue.empty(); });
+                if (stopping) return;
+
+                request = _takeFirst(queue);
+                if (!request) continue;
+
+                int expected = QUEUED;
+                if (!request->status.compare_exchange_strong(expected, DECODING)) {
+                    _forget(request);
+                    continue;
+                }
+            }
+
+            SDL_Surface *surface = IMG_Load(request->path.c_str());
+            if (surface == nullptr) {
+                SDL_Log("Could not load %s: %s\n", request->path.c_str(), SDL_GetError());
+            } else {
+                // Convert here rather than during the upload, on the main thread.
+                SDL_Surface *converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+                if (converted != nullptr) {
+                    SDL_FreeSurface(surface);
+                    surface = converted;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            request->surface = surface;
+            int expected = DECODING;
+            if (request->status.compare_exchange_strong(expected, DECODED)) {
+                decoded.push_back(request);
+            } else {
+                _forget(request);
+            }
+        }
+    }
+};
+
+#endif // ASYNC_LOADER_CPP
@@ -0,0 +1,143 @@
+#ifndef DIRTY_REGIONS_CPP
+#define DIRTY_REGIONS_CPP
+
+#include <vector>
+
+#include <SDL.h>
+
+/**
+ * The parts of the screen to redraw this frame, as a short list of rects that do not overlap.
+ *
+ * Each drawable adds where it was drawn last frame and where it is drawn now (addMove). Rects that
+ * overlap are merged, and past maxRects, the two rects that waste the least area once merged are.
+ * When the rects cover most of the screen, a single full screen redraw is cheaper than clipping
+ * several passes, so the whole screen is marked instead.
+ *
+ * See PP::render_dirty, which only clears and redraws the rects.
+ */
+class DirtyRegions {
+public:
+    /**
+     * @param maxRects: the most rects kept. Each one costs a draw pass of the whole scene, clipped
+     *  to it, so this trades submission cost against fill rate.
+     */
+    explicit DirtyRegions(unsigned maxRects = 8) : maxRects(maxRects > 0 ? maxRects : 1) {
+        // One more than kept, for the rect being inserted: adding never allocates.
+        this->list.reserve(this->maxRects + 1);
+    }
+
+    /** Set the screen size, which the rects are clipped to. Marks the whole screen. */
+    void setScreen(int width, int height) {
+        this->screen = {0, 0, width, height};
+        this->markAll();
+    }
+
+    /** Redraw the whole screen this frame, for instance after the window surface was lost. */
+    void markAll() {
+        this->list.assign(1, this->screen);
+    }
+
+    /** Whether the whole screen is to be redrawn. */
+    bool full() const {
+        return this->list.size() == 1 && SDL_RectEquals(&this->list[0], &this->screen);
+    }
+
+    /** Mark a rect to redraw, in screen coordinates. Empty rects are ignored. */
+    void add(const SDL_Rect &rect) {
+        SDL_Rect clipped;
+        if (!SDL_IntersectRect(&rect, &this->screen, &clipped)) return;
+        if (this->full()) return;
+
+        _insert(clipped);
+        while (this->list.size() > this->maxRects) {
+            _mergeCheapest();
+        }
+        if (this->area() * 4 > (unsigned long long) this->screen.w * this->screen.h * 3) {
+            this->markAll();
+        }
+    }
+
+    /**
+     * Mark what a drawable moving from one rect to another touches: where it was to erase it, and
+     * where it is. Either may be empty, when it appears or disappears.
+     */
+    void addMove(const SDL_Rect &previous, const SDL_Rect &current) {
+        this->add(previous);
+        this->add(current);
+    }
+
+    const std::vector<SDL_Rect> &rects() const {
+        return this->list;
+    }
+
+    /** Pixels covered by the rects. They do not overlap, so each pixel counts once. */
+    unsigned long long area() const {
+        unsigned long long total = 0;
+        for (const SDL_Rect &rect : this->list) {
+            total += (unsigned long long) rect.w * rect.h;
+        }
+        return total;
+    }
+
+    /** Forget the rects, once the frame is drawn. */
+    void clear() {
+        this->list.clear();
+    }
+
+private:
+    unsigned maxRects;
+    SDL_Rect screen = {0, 0, 0, 0};
+    std::vector<SDL_Rect> list;
+
+    static unsigned long long _area(const SDL_Rect &rect) {
+        return (unsigned long long) rect.w * rect.h;
+    }
+
+    /** Add a rect, merging it with every rect it overlaps, until it overlaps none. */
+    void _insert(SDL_Rect rect) {
+        bool merged = true;
+        while (merged) {
+            merged = false;
+            for (size_t i = 0; i < this->list.size(); i++) {
+                if (SDL_HasIntersection(&rect, &this->list[i])) {
+                    SDL_UnionRect(&rect, &this->list[i], &rect);
+                    this->list[i] = this->list.back();
+                    this->list.pop_back();
+                    merged = true;
+                    break;
+                }
+            }
+        }
+        this->list.push_back(rect);
+    }
+
+    /** Merge the two rects whose union covers the least area they did not. */
+    void _mergeCheapest() {
+        size_t bestA = 0, bestB = 1;
+        unsigned long long bestWaste = ~0ull;
+        for (size_t a = 0; a < this->list.size(); a++) {
+            for (size_t b = a + 1; b < this->list.size(); b++) {
+                SDL_Rect both;
+                SDL_UnionRect(&this->list[a], &this->list[b], &both);
+                const unsigned long long waste = _area(both) - _area(this->list[a]) - _area(this->list[b]);
+                if (waste < bestWaste) {
+                    bestWaste = waste;
+                    bestA = a;
+                    bestB = b;
+                }
+            }
+        }
+
+        SDL_Rect both;
+        SDL_UnionRect(&this->list[bestA], &this->list[bestB], &both);
+        // b > a, so removing b first leaves a where it is.
+        this->list[bestB] = this->list.back();
+        this->list.pop_back();
+        this->list[bestA] = this->list.back();
+        this->list.pop_back();
+        // The union may now overlap other rects.
+        _insert(both);
+    }
+};
+
+#endif // DIRTY_REGIONS_CPP
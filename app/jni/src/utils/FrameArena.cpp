@@ -0,0 +1,118 @@
+#ifndef FRAME_ARENA_CPP
+#define FRAME_ARENA_CPP
+
+#include <assert.h>
+#include <stddef.h>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/**
+ * A linear allocator for the data that only lives for a frame, or a step: allocating moves a
+ * cursor forward in one buffer, and reset() frees everything at once. Nothing is ever given back
+ * to the heap, so a warmed up arena costs no heap allocation.
+ *
+ * When the buffer is full, the allocation falls back to the heap, and the buffer grows at the next
+ * reset() to hold the whole frame. So an unexpected peak costs one frame of heap allocations,
+ * never a failure.
+ *
+ * The memory is not initialised, and nothing is destroyed: only for trivially destructible data.
+ * Not thread safe: allocate on one thread, then hand the memory over to jobs.
+ */
+class FrameArena {
+public:
+    explicit FrameArena(size_t capacity = 16 * 1024) {
+        _grow(capacity);
+    }
+
+    FrameArena(FrameArena const &) = delete;
+    void operator=(FrameArena const &) = delete;
+
+    /**
+     * Get room for the given number of bytes. The alignment must be a power of two, of at most
+     * alignof(max_align_t).
+     */
+    void *allocate(size_t size, size_t alignment = alignof(max_align_t)) {
+        assert(alignment <= alignof(max_align_t) && (alignment & (alignment - 1)) == 0);
+
+        const size_t offset = (used + alignment - 1) & ~(alignment - 1);
+        if (offset + size <= capacity) {
+            used = offset + size;
+            if (used > highWater) highWater = used;
+            return reinterpret_cast<unsigned char *>(buffer.get()) + offset;
+        }
+
+        // Full: borrow from the heap until the next reset, and remember how much was missing.
+        const size_t units = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t);
+        overflow.emplace_back(new max_align_t[units > 0 ? units : 1]);
+        overflowBytes += units * sizeof(max_align_t);
+        return overflow.back().get();
+    }
+
+    /** Get room for count objects of the given type, not constructed. */
+    template<typename T>
+    T *allocate(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "The arena does not destroy anything");
+        return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+    }
+
+    /**
+     * Free everything allocated since the last reset. If the buffer was too small, it grows to
+     * half again what the frame needed.
+     */
+    void reset() {
+        if (!overflow.empty()) {
+            const size_t needed = used + overflowBytes;
+            overflow.clear();
+            overflowBytes = 0;
+            overflows++;
+            _grow(needed + needed / 2);
+        }
+        used = 0;
+    }
+
+    /** Make the buffer hold at least the given number of bytes. Frees everything allocated. */
+    void reserve(size_t bytes) {
+        overflow.clear();
+        overflowBytes = 0;
+        used = 0;
+        if (bytes > capacity) _grow(bytes);
+    }
+
+    size_t getUsed() const {
+        return used;
+    }
+
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+    /** Most bytes used between two resets, not counting the overflows. */
+    size_t getHighWater() const {
+        return highWater;
+    }
+
+    /** Number of frames that did not fit in the buffer. */
+    unsigned getOverflows() const {
+        return overflows;
+    }
+
+private:
+    std::unique_ptr<max_align_t[]> buffer;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t highWater = 0;
+
+    std::vector<std::unique_ptr<max_align_t[]>> overflow;
+    size_t overflowBytes = 0;
+    unsigned overflows = 0;
+
+    void _grow(size_t bytes) {
+        const size_t units = (bytes + sizeof(max_align_t) - 1) / sizeof(max_align_t);
+        buffer.reset(new max_align_t[units > 0 ? units : 1]);
+        capacity = units * sizeof(max_align_t);
+        used = 0;
+    }
+};
+
+#endif // FRAME_ARENA_CPP
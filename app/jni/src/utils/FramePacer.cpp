@@ -0,0 +1,182 @@
+#ifndef FRAME_PACER_CPP
+#define FRAME_PACER_CPP
+
+#include <SDL.h>
+
+#include "Stats.cpp"
+
+/**
+ * Starts the frames at a steady rate, on the performance counter.
+ *
+ * SDL_Delay only has a millisecond granularity, and the scheduler often wakes the thread late. So
+ * wait() sleeps until a little before the deadline, then spins on the counter for the rest. The
+ * margin kept for the spin adapts to how late the sleeps actually wake up on the device.
+ *
+ * The deadlines follow each other by exactly one period, so an early or late frame does not shift
+ * the next ones. A frame late by more than a whole period restarts the schedule instead of
+ * rushing the next frames to catch up.
+ *
+ * With vsync, the present already blocks until the display refresh: wait() does not wait, and the
+ * target only serves the statistics.
+ */
+class FramePacer {
+public:
+    /** @param targetHz: frames per second to aim for, such as 30, 60, 90 or 120. */
+    explicit FramePacer(unsigned targetHz = 60, bool vsync = false) : vsync(vsync) {
+        setTarget(targetHz);
+    }
+
+    void setTarget(unsigned targetHz) {
+        this->targetHz = targetHz > 0 ? targetHz : 60;
+        this->period = SDL_GetPerformanceFrequency() / this->targetHz;
+        this->deadline = 0;
+    }
+
+    unsigned getTarget() const {
+        return this->targetHz;
+    }
+
+    void setVsync(bool vsync) {
+        this->vsync = vsync;
+        this->deadline = 0;
+    }
+
+    /**
+     * Wait until the next frame is due. Call it once per frame, after the present.
+     *
+     * @return the number of deadlines missed by this frame (0 when on time).
+     */
+    unsigned wait() {
+        const Uint64 frequency = SDL_GetPerformanceFrequency();
+        Uint64 now = SDL_GetPerformanceCounter();
+        unsigned missed = 0;
+
+        if (this->deadline == 0) {
+            this->deadline = now + this->period;
+        } else if (!this->vsync) {
+            if (now > this->deadline) {
+                missed = (unsigned) ((now - this->deadline) / this->period) + 1;
+                this->missedFrames += missed;
+                // Late by more than a period: start again from now.
+                if (missed > 1) this->deadline = now;
+            } else {
+                _sleepUntil(this->deadline, frequency);
+                now = _spinUntil(this->deadline);
+                // The sleep itself overshot the deadline by more than 5% of a period.
+                if (now - this->deadline > this->period / 20) this->lateWakeUps++;
+            }
+            this->deadline += this->period;
+        }
+
+        if (this->lastFrameAt != 0) {
+            const double interval = (double) (now - this->lastFrameAt) * 1000.0 / frequency;
+            const double targetMs = 1000.0 / this->targetHz;
+            this->intervals.add(interval);
+            this->jitter.add(interval > targetMs ? interval - targetMs : targetMs - interval);
+        }
+        this->lastFrameAt = now;
+
+        if (this->reportEvery > 0 && ++this->frames >= this->reportEvery) {
+            this->report();
+            this->frames = 0;
+        }
+        return missed;
+    }
+
+    /** Log the statistics of the frame intervals now, every given number of frames (0 for never). */
+    void setReportEvery(unsigned frames) {
+        this->reportEvery = frames;
+    }
+
+    /** Distribution of the time between two frame starts, in ms. */
+    Percentiles intervalPercentiles() {
+        return this->intervals.percentiles();
+    }
+
+    /** Distribution of how far the frame intervals are from the target period, in ms. */
+    Percentiles jitterPercentiles() {
+        return this->jitter.percentiles();
+    }
+
+    /** Number of frames that ended after their deadline. */
+    unsigned long long getMissedFrames() const {
+        return this->missedFrames;
+    }
+
+    /** Number of frames on time, but started late because the sleep woke up late. */
+    unsigned long long getLateWakeUps() const {
+        return this->lateWakeUps;
+    }
+
+    /** Margin currently kept for the spin before the deadline, in ms. */
+    double getSpinMarginMs() const {
+        return this->spinMarginMs;
+    }
+
+    void report() {
+        const Percentiles interval = this->intervals.percentiles();
+        const Percentiles deviation = this->jitter.percentiles();
+        SDL_Log("Pacing: %u Hz%s, interval %.2f ms p50, %.2f ms p99, %.2f ms max, jitter %.3f ms p50, %.3f ms p95, %.3f ms p99, %llu missed, %llu late wake ups, spin margin %.2f ms\n",
+                this->targetHz, this->vsync ? " (vsync)" : "", interval.p50, interval.p99, interval.max,
+                deviation.p50, deviation.p95, deviation.p99, this->missedFrames, this->lateWakeUps,
+                this->spinMarginMs);
+    }
+
+private:
+    unsigned targetHz = 60;
+    bool vsync;
+
+    /** Frame period, and deadline of the current frame, in performance counter ticks. */
+    Uint64 period = 0;
+    Uint64 deadline = 0;
+    Uint64 lastFrameAt = 0;
+
+    /**
+     * How late the sleeps wake up, at most lately, in ms. Raised at once by a late wake up, and
+     * lowered slowly. Kept within [0.5 ms, a quarter of the period].
+     */
+    double spinMarginMs = 2;
+
+    RollingSamples intervals{600};
+    RollingSamples jitter{600};
+    unsigned long long missedFrames = 0;
+    unsigned long long lateWakeUps = 0;
+    unsigned frames = 0;
+    unsigned reportEvery = 0;
+
+    /** Sleep until the spin margin before the deadline, if there is time for it. */
+    void _sleepUntil(Uint64 deadline, Uint64 frequency) {
+        const Uint64 start = SDL_GetPerformanceCounter();
+        if (start >= deadline) return;
+
+        const double remainingMs = (double) (deadline - start) * 1000.0 / frequency;
+        const double sleepMs = remainingMs - this->spinMarginMs;
+        if (sleepMs < 1) return;
+
+        const Uint32 requested = (Uint32) sleepMs;
+        SDL_Delay(requested);
+
+        const double sleptMs = (double) (SDL_GetPerformanceCounter() - start) * 1000.0 / frequency;
+        const double oversleep = sleptMs - requested;
+        if (oversleep > this->spinMarginMs) {
+            this->spinMarginMs = oversleep;
+        } else {
+            this->spinMarginMs = this->spinMarginMs * 0.99 + oversleep * 0.01;
+        }
+        // Spinning burns the battery: past a quarter of the period, rather be late once in a while.
+        const double maxMarginMs = 250.0 / this->targetHz;
+        if (this->spinMarginMs > maxMarginMs) this->spinMarginMs = maxMarginMs;
+        if (this->spinMarginMs < 0.5) this->spinMarginMs = 0.5;
+    }
+
+    /** Busy wait until the deadline. Returns the time it ended. */
+    static Uint64 _spinUntil(Uint64 deadline) {
+        Uint64 now = SDL_GetPerformanceCounter();
+        while (now < deadline) {
+            now = SDL_GetPerformanceCounter();
+        }
+        return now;
+    }
+};
+
+#endif // FRAME_PACER_CPP
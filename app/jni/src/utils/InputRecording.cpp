@@ -0,0 +1,306 @@
+#ifndef INPUT_RECORDING_CPP
+#define INPUT_RECORDING_CPP
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include <SDL.h>
+
+/**
+ * Recordings of the input of a session, to play it again without a window (see InputReplay).
+ *
+ * The file is little-endian binary:
+ *  - a header: the magic "SDLR", the format version (u16), the flags (u16), the screen width and
+ *    height (i32 each);
+ *  - then one record per frame: the frame duration in seconds (f32), the number of events (u16),
+ *    the state hash after the frame's updates (u64, only with HASHES), then the events.
+ *  - An event is its SDL type (u32), the finger id (i64), and x and y (f32 each).
+ *
+ * Only the events the game handles are kept: quit and fingers.
+ */
+namespace InputRecording {
+    static const char MAGIC[4] = {'S', 'D', 'L', 'R'};
+    static const uint16_t VERSION = 1;
+
+    /** The records hold the state hash of the frames. */
+    static const uint16_t HASHES = 1;
+
+    /** An event, as much of it as the game uses. */
+    struct Event {
+        uint32_t type;
+        int64_t fingerId;
+        float x;
+        float y;
+
+        /** Get it back as an SDL event. */
+        SDL_Event toSDL() const {
+            SDL_Event event;
+            memset(&event, 0, sizeof(event));
+            event.type = type;
+            if (type == SDL_FINGERDOWN || type == SDL_FINGERUP || type == SDL_FINGERMOTION) {
+                event.tfinger.fingerId = fingerId;
+                event.tfinger.x = x;
+                event.tfinger.y = y;
+            }
+            return event;
+        }
+    };
+
+    /** Whether the event is one the recordings keep. */
+    inline bool recorded(const SDL_Event &event) {
+        return event.type == SDL_QUIT || event.type == SDL_FINGERDOWN || event.type == SDL_FINGERUP ||
+               event.type == SDL_FINGERMOTION;
+    }
+}
+
+/**
+ * Writes the input of a session to a file, frame by frame. The records are buffered in memory and
+ * written by blocks, so recording costs no file access on most frames.
+ *
+ * A session only replays the same if the game is deterministic: the serial loop (not the
+ * pipelined one), the same build, and for other ABIs, fixed-point reals.
+ */
+class InputRecorder {
+public:
+    InputRecorder() = default;
+
+    ~InputRecorder() {
+        close();
+    }
+
+    InputRecorder(InputRecorder const &) = delete;
+    void operator=(InputRecorder const &) = delete;
+
+    /**
+     * Start recording into the given file, replacing it.
+     *
+     * @param hashes: also record the state hash of each frame, for the replay to check against.
+     *  Hashing costs a pass over every particle per frame.
+     */
+    bool open(const std::string &path, int width, int height, bool hashes) {
+        close();
+
+        file = SDL_RWFromFile(path.c_str(), "wb");
+        if (file == nullptr) {
+            SDL_Log("Could not open the recording %s: %s\n", path.c_str(), SDL_GetError());
+            return false;
+        }
+
+        this->hashes = hashes;
+        buffer.insert(buffer.end(), InputRecording::MAGIC, InputRecording::MAGIC + 4);
+        _write16(InputRecording::VERSION);
+        _write16(hashes ? InputRecording::HASHES : 0);
+        _write32((uint32_t) width);
+        _write32((uint32_t) height);
+        return true;
+    }
+
+    bool recording() const {
+        return file != nullptr;
+    }
+
+    /** Whether the frames need their state hash. */
+    bool recordsHashes() const {
+        return hashes;
+    }
+
+    /** Record an event of the current frame. Ignored if the game does not use it. */
+    void event(const SDL_Event &event) {
+        if (!recording() || !InputRecording::recorded(event)) return;
+
+        InputRecording::Event recorded = {event.type, 0, 0, 0};
+        if (event.type != SDL_QUIT) {
+            recorded.fingerId = event.tfinger.fingerId;
+            recorded.x = event.tfinger.x;
+            recorded.y = event.tfinger.y;
+        }
+        events.push_back(recorded);
+    }
+
+    /**
+     * Close the record of the current frame.
+     *
+     * @param duration: the frame duration, as given to the timestep.
+     * @param hash: the state hash after the updates of the frame, if recordsHashes().
+     */
+    void endFrame(float duration, uint64_t hash = 0) {
+        if (!recording()) return;
+
+        _writeFloat(duration);
+        _write16((uint16_t) events.size());
+        if (hashes) _write64(hash);
+        for (const InputRecording::Event &event : events) {
+            _write32(event.type);
+            _write64((uint64_t) event.fingerId);
+            _writeFloat(event.x);
+            _writeFloat(event.y);
+        }
+        events.clear();
+        frames++;
+
+        if (buffer.size() >= flushSize) _flush();
+    }
+
+    /** Write what is left and close the file. */
+    void close() {
+        if (!recording()) return;
+
+        _flush();
+        SDL_RWclose(file);
+        file = nullptr;
+        SDL_Log("Recorded %u frames\n", frames);
+        frames = 0;
+    }
+
+private:
+    /** Size from which the buffer is written to the file. */
+    const static size_t flushSize = 64 * 1024;
+
+    SDL_RWops *file = nullptr;
+    bool hashes = false;
+    unsigned frames = 0;
+    std::vector<InputRecording::Event> events;
+    std::vector<uint8_t> buffer;
+
+    void _flush() {
+        if (buffer.empty()) return;
+        if (SDL_RWwrite(file, buffer.data(), 1, buffer.size()) != buffer.size()) {
+            SDL_Log("Could not write the recording: %s\n", SDL_GetError());
+        }
+        buffer.clear();
+    }
+
+    void _write16(uint16_t value) {
+        buffer.push_back((uint8_t) value);
+        buffer.push_back((uint8_t) (value >> 8));
+    }
+
+    void _write32(uint32_t value) {
+        _write16((uint16_t) value);
+        _write16((uint16_t) (value >> 16));
+    }
+
+    void _write64(uint64_t value) {
+        _write32((uint32_t) value);
+        _write32((uint32_t) (value >> 32));
+    }
+
+    void _writeFloat(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        _write32(bits);
+    }
+};
+
+/** Reads back a file written by InputRecorder, frame by frame. */
+class InputReplay {
+public:
+    struct Frame {
+        float duration = 0;
+        bool hasHash = false;
+        uint64_t hash = 0;
+        std::vector<InputRecording::Event> events;
+    };
+
+    /** Load the whole recording. Returns false if it cannot be read or is not a recording. */
+    bool open(const std::string &path) {
+        data.clear();
+        position = 0;
+
+        SDL_RWops *file = SDL_RWFromFile(path.c_str(), "rb");
+        if (file == nullptr) {
+            SDL_Log("Could not open the recording %s: %s\n", path.c_str(), SDL_GetError());
+            return false;
+        }
+        uint8_t block[16 * 1024];
+        size_t read;
+        while ((read = SDL_RWread(file, block, 1, sizeof(block))) > 0) {
+            data.insert(data.end(), block, block + read);
+        }
+        SDL_RWclose(file);
+
+        if (data.size() < 16 || memcmp(data.data(), InputRecording::MAGIC, 4) != 0) {
+            SDL_Log("%s is not a recording\n", path.c_str());
+            return false;
+        }
+        position = 4;
+        const uint16_t version = _read16();
+        if (version != InputRecording::VERSION) {
+            SDL_Log("%s is a recording of version %u, not %u\n", path.c_str(), version, InputRecording::VERSION);
+            return false;
+        }
+        hashes = (_read16() & InputRecording::HASHES) != 0;
+        width = (int) _read32();
+        height = (int) _read32();
+        return true;
+    }
+
+    int getWidth() const {
+        return width;
+    }
+
+    int getHeight() const {
+        return height;
+    }
+
+    bool hasHashes() const {
+        return hashes;
+    }
+
+    /** Read the next frame. Returns false at the end of the recording, or if it is truncated. */
+    bool next(Frame &frame) {
+        const size_t header = 6 + (hashes ? 8 : 0);
+        if (data.size() - position < header) return false;
+
+        frame.duration = _readFloat();
+        const uint16_t count = _read16();
+        frame.hasHash = hashes;
+        frame.hash = hashes ? _read64() : 0;
+
+        const size_t eventSize = 20;
+        if (data.size() - position < count * eventSize) return false;
+
+        frame.events.resize(count);
+        for (InputRecording::Event &event : frame.events) {
+            event.type = _read32();
+            event.fingerId = (int64_t) _read64();
+            event.x = _readFloat();
+            event.y = _readFloat();
+        }
+        return true;
+    }
+
+private:
+    std::vector<uint8_t> data;
+    size_t position = 0;
+    bool hashes = false;
+    int width = 0;
+    int height = 0;
+
+    uint16_t _read16() {
+        const uint16_t value = (uint16_t) (data[position] | data[position + 1] << 8);
+        position += 2;
+        return value;
+    }
+
+    uint32_t _read32() {
+        const uint32_t low = _read16();
+        return low | (uint32_t) _read16() << 16;
+    }
+
+    uint64_t _read64() {
+        const uint64_t low = _read32();
+        return low | (uint64_t) _read32() << 32;
+    }
+
+    float _readFloat() {
+        const uint32_t bits = _read32();
+        float value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+};
+
+#endif // INPUT_RECORDING_CPP
@@ -0,0 +1,198 @@
+#ifndef JOB_SYSTEM_CPP
+#define JOB_SYSTEM_CPP
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * A small pool of worker threads, one per core, running ranges of indices in parallel.
+ *
+ * Each worker owns a queue of tasks. parallelFor cuts the range in chunks and deals them to the
+ * queues. A worker pops its own tasks from the back, and when it runs out, steals from the front
+ * of the other queues, so an uneven split still keeps every core busy.
+ * The calling thread is worker 0 and takes part in the work, so parallelFor returns only once
+ * every chunk has been run.
+ */
+class JobSystem {
+public:
+    /**
+     * @param workerCount: number of workers, including the calling thread. Zero means one per
+     *  core.
+     */
+    explicit JobSystem(unsigned workerCount = 0) {
+        if (workerCount == 0) {
+            workerCount = std::thread::hardware_concurrency();
+        }
+        if (workerCount == 0) {
+            workerCount = 1;
+        }
+
+        queues = std::vector<Queue>(workerCount);
+        for (unsigned i = 1; i < workerCount; i++) {
+            threads.emplace_back(&JobSystem::_work, this, i);
+        }
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+
+    JobSystem(JobSystem const &) = delete;
+    void operator=(JobSystem const &) = delete;
+
+    unsigned getWorkerCount() const {
+        return static_cast<unsigned>(queues.size());
+    }
+
+    /**
+     * Call func(chunkBegin, chunkEnd) on consecutive chunks of at most grain indices covering
+     * [begin, end), in parallel. The chunks start at begin + k * grain, so the caller can find
+     * the chunk index back to write into per-chunk buffers without any locking.
+     *
+     * The calling thread plays the part of worker 0, so it must not be called from two threads
+     * at once.
+     */
+    template<typename Func>
+    void parallelFor(unsigned begin, unsigned end, unsigned grain, const Func &func) {
+        if (begin >= end) return;
+        if (grain == 0) grain = 1;
+
+        // Not worth waking anybody up for a single chunk.
+        if (queues.size() == 1 || end - begin <= grain) {
+            for (unsigned chunk = begin; chunk < end; chunk += grain) {
+                func(chunk, end - chunk < grain ? end : chunk + grain);
+            }
+            return;
+        }
+
+        // A worker still looking for work from the last call may pick a chunk as soon as it is
+        // queued, so the count must be set first.
+        pending.store((end - begin + grain - 1) / grain);
+
+        // Deal the chunks to the workers, round robin.
+        unsigned chunkIndex = 0;
+        for (unsigned chunk = begin; chunk < end; chunk += grain, chunkIndex++) {
+            Task task = {&JobSystem::_call<Func>, &func, chunk, end - chunk < grain ? end : chunk + grain};
+
+            Queue &queue = queues[chunkIndex % queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(task);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            generation++;
+        }
+        wake.notify_all();
+
+        // Help until everything is done. Other workers may still be running the last chunks once
+        // there is nothing left to pop or steal.
+        while (pending.load() > 0) {
+            if (!_runOne(0)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    struct Task {
+        void (*call)(const void *func, unsigned begin, unsigned end);
+        const void *func;
+        unsigned begin;
+        unsigned end;
+    };
+
+    /**
+     * The owner takes tasks from the back, thieves from the front (head). The vector is reset once
+     * emptied, so it keeps its capacity and the steady state does not allocate.
+     */
+    struct Queue {
+        std::mutex mutex;
+        std::vector<Task> tasks;
+        size_t head = 0;
+    };
+
+    std::vector<Queue> queues;
+    std::vector<std::thread> threads;
+
+    /** Number of chunks of the current parallelFor not finished yet. */
+    std::atomic<unsigned> pending{0};
+
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    unsigned generation = 0;
+    bool stopping = false;
+
+    template<typename Func>
+    static void _call(const void *func, unsigned begin, unsigned end) {
+        (*static_cast<const Func *>(func))(begin, end);
+    }
+
+    bool _popBack(Queue &queue, Task &task) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.head == queue.tasks.size()) return false;
+
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+        if (queue.head == queue.tasks.size()) {
+            queue.tasks.clear();
+            queue.head = 0;
+        }
+        return true;
+    }
+
+    bool _stealFront(Queue &queue, Task &task) {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.head == queue.tasks.size()) return false;
+
+        task = queue.tasks[queue.head++];
+        if (queue.head == queue.tasks.size()) {
+            queue.tasks.clear();
+            queue.head = 0;
+        }
+        return true;
+    }
+
+    /** Run one task of our own queue, or stolen from another one. Returns false if none was found. */
+    bool _runOne(unsigned worker) {
+        Task task;
+        bool found = _popBack(queues[worker], task);
+
+        for (unsigned i = 1; !found && i < queues.size(); i++) {
+            found = _stealFront(queues[(worker + i) % queues.size()], task);
+        }
+        if (!found) return false;
+
+        task.call(task.func, task.begin, task.end);
+        pending.fetch_sub(1);
+        return true;
+    }
+
+    void _work(unsigned worker) {
+        unsigned seenGeneration = 0;
+
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                wake.wait(lock, [&]() { return stopping || generation != seenGeneration; });
+                if (stopping) return;
+                seenGeneration = generation;
+            }
+
+            while (_runOne(worker)) {}
+        }
+    }
+};
+
+#endif // JOB_SYSTEM_CPP
@@ -1,12 +1,14 @@
 #ifndef PP_CPP
 #define PP_CPP
 
-#include <functional>
+#include <iostream>
+#include <vector>
 
 #include <SDL.h>
 #include <SDL_image.h>
 
-class Game;  // Cyclic import.
+#include "DirtyRegions.cpp"
+#include "Profiler.cpp"
 
 class PP {
 public:
@@ -20,7 +22,12 @@ public:
     PP(PP const &) = delete;
     void operator=(PP const &) = delete;
 
-    int init(const char *title, int xpos, int ypos) {
+    /**
+     * Create the window and its renderer.
+     *
+     * @param vsync: make the present wait for the display refresh.
+     */
+    int init(const char *title, int xpos, int ypos, bool vsync = false) {
         if (this->is_init)
             return -1;
 
@@ -37,12 +44,16 @@ public:
             return false;
         }
 
-        this->renderer = SDL_CreateRenderer(window, -1, 0);
+        this->renderer = SDL_CreateRenderer(window, -1, vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
         if (this->renderer == nullptr) {
             SDL_Log("Could not create renderer: %s\n", SDL_GetError());
             return false;
         }
 
+        // The software renderer draws in the window surface, which keeps its pixels after a present.
+        SDL_RendererInfo info;
+        this->retained = SDL_GetRendererInfo(this->renderer, &info) == 0 && (info.flags & SDL_RENDERER_SOFTWARE);
+
         // Get the actual width and height of the screen.
         SDL_GetWindowSize(this->window, &this->screen_width, &this->screen_height);
         std::cout << "Window size: " << this->screen_width << " per " << this->screen_height << std::endl;
@@ -50,25 +61,129 @@ public:
         return true;
     }
 
+    /**
+     * Initialise the PP without any window, rendering into an offscreen surface
+     * through the software renderer. Used by benchmarks and tools.
+     */
+    int init_software(int width, int height) {
+        if (this->is_init)
+            return -1;
+
+        is_init = true;
+
+        if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+            SDL_Log("SDL could not initialize: %s\n", SDL_GetError());
+            return false;
+        }
+
+        this->surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (this->surface == nullptr) {
+            SDL_Log("Could not create surface: %s\n", SDL_GetError());
+            return false;
+        }
+
+        this->renderer = SDL_CreateSoftwareRenderer(this->surface);
+        if (this->renderer == nullptr) {
+            SDL_Log("Could not create renderer: %s\n", SDL_GetError());
+            return false;
+        }
+
+        this->screen_width = width;
+        this->screen_height = height;
+        this->retained = true;
+
+        return true;
+    }
+
+    SDL_Renderer *get_renderer() {
+        return renderer;
+    }
+
+    int get_screen_width() const {
+        return screen_width;
+    }
+
+    int get_screen_height() const {
+        return screen_height;
+    }
+
     bool getEvents(SDL_Event *event) {
         return SDL_PollEvent(event);
     }
 
     /**
-    * Render the SDL and a game object.
+    * Render the SDL and a game object, drawn by the given method of it. Taken as a member
+    * pointer rather than a std::function, which may allocate at every call.
     */
-    void render(Game* game, std::function<void(Game*, SDL_Renderer*)> func) {
-        // Set the default color of the screen before the clear.
-        SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
-        // Clear the screen.
-        SDL_RenderClear(renderer);
+    template<typename Drawer>
+    void render(Drawer* drawer, void (Drawer::*func)(SDL_Renderer*)) {
+        {
+            PROFILE_SCOPE("render");
+
+            // Set the default color of the screen before the clear.
+            SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
+            // Clear the screen.
+            SDL_RenderClear(renderer);
 
-        func(game, this->renderer);
+            (drawer->*func)(this->renderer);
+        }
 
         // Update the screen.
+        PROFILE_SCOPE("present");
         SDL_RenderPresent(renderer);
     }
 
+    /**
+     * Render only the dirty regions of the screen: each rect is cleared, then the game is drawn
+     * again, clipped to it, and only the rects are presented. Rects queued with batch_pixel or
+     * drawn with render_pixel entirely out of the current region are skipped, and the drawer can
+     * skip more with is_visible.
+     *
+     * Only for the software renderer, which draws in the window surface: the rest of the frame is
+     * still there from the last one. Other renderers leave the back buffer undefined after a
+     * present, and keeping the frame in a texture costs a full screen copy per frame, more than the
+     * full redraw saved: they fall back to render(), marking the whole screen.
+     *
+     * @return the number of pixels cleared and drawn again.
+     */
+    template<typename Drawer>
+    unsigned long long render_dirty(Drawer* drawer, void (Drawer::*func)(SDL_Renderer*), DirtyRegions &regions) {
+        if (!retained) {
+            regions.markAll();
+            render(drawer, func);
+            return (unsigned long long) screen_width * screen_height;
+        }
+
+        {
+            PROFILE_SCOPE("render");
+
+            for (const SDL_Rect &region : regions.rects()) {
+                clip = region;
+                has_clip = true;
+                SDL_RenderSetClipRect(renderer, &clip);
+
+                SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
+                SDL_RenderFillRect(renderer, &clip);
+
+                (drawer->*func)(this->renderer);
+            }
+            has_clip = false;
+            SDL_RenderSetClipRect(renderer, nullptr);
+        }
+
+        PROFILE_SCOPE("present");
+#if SDL_VERSION_ATLEAST(2, 0, 10)
+        if (window != nullptr) {
+            // SDL_RenderPresent would update the whole window surface.
+            SDL_RenderFlush(renderer);
+            SDL_UpdateWindowSurfaceRects(window, regions.rects().data(), (int) regions.rects().size());
+            return regions.area();
+        }
+#endif
+        SDL_RenderPresent(renderer);
+        return regions.area();
+    }
+
     /**
      * Render a rectangle, but with an intuitive position (as SDL set 0, 0 to top left.)
      *
@@ -87,15 +202,168 @@ public:
         SDL_SetRenderDrawColor(renderer, r, g, b, a);
 
         SDL_Rect fillRect = {screen_width - x, screen_height - y, w, h};
+        if (!is_visible(fillRect)) return;
         SDL_RenderFillRect(renderer, &fillRect);
     }
 
+    /**
+     * Render many rectangles of the same color in one call. The rects must already be in screen
+     * coordinates (see to_screen).
+     */
+    void render_rects(SDL_Renderer* renderer, Uint8 r, Uint8 g, Uint8 b, Uint8 a, const SDL_Rect *rects, int count) {
+        if (count <= 0) return;
+
+        SDL_SetRenderDrawColor(renderer, r, g, b, a);
+        SDL_RenderFillRects(renderer, rects, count);
+    }
+
+    /**
+     * Whether anything drawn in the given rect, in screen coordinates, can be seen: it must touch
+     * the screen, and the region being redrawn by render_dirty if any.
+     */
+    bool is_visible(const SDL_Rect &rect) const {
+        if (rect.x >= screen_width || rect.y >= screen_height || rect.x + rect.w <= 0 || rect.y + rect.h <= 0)
+            return false;
+        return !has_clip || SDL_HasIntersection(&rect, &clip);
+    }
+
+    /** Convert an intuitive position (0, 0 at the bottom right) to an SDL rect. */
+    SDL_Rect to_screen(int x, int y, int w, int h) const {
+        return {screen_width - x, screen_height - y, w, h};
+    }
+
+    /**
+     * Queue a rectangle, with the same coordinates as render_pixel, to be drawn by the next
+     * flush_batch. Rects are grouped by color, so the flush costs one color change and one
+     * fill call per distinct color, whatever the number of rects.
+     *
+     * Returns false, queuing nothing, if the rect cannot be seen (see is_visible).
+     */
+    bool batch_pixel(Uint8 r, Uint8 g, Uint8 b, Uint8 a, int x, int y, int w, int h) {
+        const SDL_Rect rect = to_screen(x, y, w, h);
+        if (!is_visible(rect)) return false;
+
+        const Uint32 color = (Uint32) r << 24 | (Uint32) g << 16 | (Uint32) b << 8 | a;
+
+        // Consecutive rects are very likely to share their color, so check the last group first.
+        if (last_batch >= batches.size() || batches[last_batch].color != color) {
+            last_batch = 0;
+            while (last_batch < batches.size() && batches[last_batch].color != color)
+                last_batch++;
+
+            if (last_batch == batches.size()) {
+                batches.push_back({color, {}});
+                batches.back().rects.reserve(batch_capacity);
+            }
+        }
+
+        batches[last_batch].rects.push_back(rect);
+        return true;
+    }
+
+    /**
+     * Make room for the given number of colors, and of rects per color, in the batch of
+     * batch_pixel, so that queuing up to that many does not allocate. Without it, the batch
+     * grows to the busiest frame seen.
+     */
+    void reserve_batch(size_t colors, size_t rects) {
+        batches.reserve(colors);
+        batch_capacity = rects;
+        for (auto &batch : batches) {
+            batch.rects.reserve(rects);
+        }
+    }
+
+    /** Draw every rect queued by batch_pixel, one fill call per color. */
+    void flush_batch(SDL_Renderer* renderer) {
+        for (auto &batch : batches) {
+            render_rects(renderer, batch.color >> 24, batch.color >> 16, batch.color >> 8, batch.color,
+                         batch.rects.data(), static_cast<int>(batch.rects.size()));
+            // Clearing keeps the capacity, so a steady frame does not allocate.
+            batch.rects.clear();
+        }
+    }
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    /**
+     * Draw every rect queued by batch_pixel in a single SDL_RenderGeometry call, whatever the
+     * number of colors. Costs more CPU to build the vertices than flush_batch, but only one
+     * submission to the renderer.
+     */
+    void flush_batch_geometry(SDL_Renderer* renderer) {
+        vertices.clear();
+        indices.clear();
+
+        for (auto &batch : batches) {
+            const SDL_Color color = {(Uint8) (batch.color >> 24), (Uint8) (batch.color >> 16),
+                                     (Uint8) (batch.color >> 8), (Uint8) batch.color};
+
+            for (const SDL_Rect &rect : batch.rects) {
+                const int first = static_cast<int>(vertices.size());
+                const float x0 = (float) rect.x, y0 = (float) rect.y;
+                const float x1 = (float) (rect.x + rect.w), y1 = (float) (rect.y + rect.h);
+
+                vertices.push_back({{x0, y0}, color, {0, 0}});
+                vertices.push_back({{x1, y0}, color, {0, 0}});
+                vertices.push_back({{x1, y1}, color, {0, 0}});
+                vertices.push_back({{x0, y1}, color, {0, 0}});
+
+                const int quad[6] = {first, first + 1, first + 2, first, first + 2, first + 3};
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+            batch.rects.clear();
+        }
+
+        if (!indices.empty()) {
+            SDL_RenderGeometry(renderer, nullptr, vertices.data(), static_cast<int>(vertices.size()),
+                               indices.data(), static_cast<int>(indices.size()));
+        }
+    }
+#endif
+
+    /**
+     * Draw a frame drawn on the CPU (see ParticleRaster) over the whole screen. The pixels are
+     * ARGB8888, pitch bytes per row, and replace what is below. They are uploaded in one
+     * SDL_UpdateTexture to a streaming texture, kept from one frame to the next.
+     */
+    void blit_pixels(SDL_Renderer* renderer, const void *pixels, int width, int height, int pitch) {
+        if (streaming_texture == nullptr || streaming_width != width || streaming_height != height) {
+            SDL_DestroyTexture(streaming_texture);
+            streaming_texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+                                                  width, height);
+            if (streaming_texture == nullptr) {
+                SDL_Log("Could not create the streaming texture: %s\n", SDL_GetError());
+                return;
+            }
+            SDL_SetTextureBlendMode(streaming_texture, SDL_BLENDMODE_NONE);
+            streaming_width = width;
+            streaming_height = height;
+        }
+
+        if (SDL_UpdateTexture(streaming_texture, nullptr, pixels, pitch) != 0) {
+            SDL_Log("Could not update the streaming texture: %s\n", SDL_GetError());
+            return;
+        }
+        SDL_RenderCopy(renderer, streaming_texture, nullptr, nullptr);
+    }
+
+    /**
+     * Drop the textures of the PP after the renderer lost them (SDL_RENDER_DEVICE_RESET). They are
+     * created again on their next use.
+     */
+    void reset_textures() {
+        SDL_DestroyTexture(streaming_texture);
+        streaming_texture = nullptr;
+    }
+
     /**
     * Clean the PP and any objects.
     */
     void clean() {
+        reset_textures();
         SDL_DestroyWindow(window);
         SDL_DestroyRenderer(renderer);
+        SDL_FreeSurface(surface);
 
         SDL_Quit();
     }
@@ -109,6 +377,36 @@ private:
     SDL_Window *window{};
     SDL_Renderer *renderer{};
 
+    /** Only set when rendering offscreen, see init_software. */
+    SDL_Surface *surface{};
+
+    /** Rects queued by batch_pixel, grouped by color (packed as RGBA). */
+    struct ColorBatch {
+        Uint32 color;
+        std::vector<SDL_Rect> rects;
+    };
+    std::vector<ColorBatch> batches;
+    size_t last_batch = 0;
+    /** Rects reserved in each new batch, see reserve_batch. */
+    size_t batch_capacity = 0;
+
+    /** Whether the default target keeps its pixels from one frame to the next, see render_dirty. */
+    bool retained = false;
+
+    /** The region being redrawn by render_dirty. */
+    SDL_Rect clip{};
+    bool has_clip = false;
+
+    /** Target of blit_pixels, and its size. */
+    SDL_Texture *streaming_texture{};
+    int streaming_width{};
+    int streaming_height{};
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+#endif
+
     /** Constructor is private as this is a singleton. */
     PP() {}
 };
@@ -0,0 +1,337 @@
+#ifndef PARTICLE_RASTER_CPP
+#define PARTICLE_RASTER_CPP
+
+#include <stdint.h>
+#include <vector>
+
+#include "JobSystem.cpp"
+#include "../phygine/ParticleSnapshot.cpp"
+
+/**
+ * Draws particles into a CPU pixel buffer, without SDL, to be uploaded to a streaming texture
+ * once per frame (see PP::blit_pixels). For dense scenes, this is much cheaper than a fill call
+ * per particle, and it runs headless, so its fill rate can be measured without any GPU.
+ *
+ * The buffer is ARGB8888, row after row, and holds the whole frame: clear() it with the
+ * background first. The particles use the same coordinates as PP::to_screen (0, 0 at the bottom
+ * right), and each covers a square of its size, from its top left corner.
+ *
+ * With a JobSystem, the frame is cut in bands of rows drawn in parallel. The particles are first
+ * sorted into the bands they touch, so that each band is only written by one worker, and no
+ * locking is needed.
+ */
+class ParticleRaster {
+public:
+    enum Blend {
+        /** Adds the particles to what is below, saturating: for glows on a dark background. */
+        ADD,
+        /** Paints the particles over what is below, weighted by their coverage. */
+        OVER
+    };
+
+    ParticleRaster() = default;
+
+    ParticleRaster(ParticleRaster const &) = delete;
+    void operator=(ParticleRaster const &) = delete;
+
+    /** Change the size of the buffer. The content is lost. */
+    void resize(int width, int height) {
+        this->width = width > 0 ? width : 0;
+        this->height = height > 0 ? height : 0;
+        this->pixels.assign((size_t) this->width * this->height, 0);
+    }
+
+    int getWidth() const {
+        return this->width;
+    }
+
+    int getHeight() const {
+        return this->height;
+    }
+
+    /** The pixels, ARGB8888, width per row. */
+    const uint32_t *getPixels() const {
+        return this->pixels.data();
+    }
+
+    /** Bytes per row, for SDL_UpdateTexture. */
+    int getPitch() const {
+        return this->width * (int) sizeof(uint32_t);
+    }
+
+    /**
+     * Allocate the room to draw the given number of particles, so that drawing up to that many
+     * does not allocate. Call it after resize().
+     */
+    void reserve(unsigned particles) {
+        this->left.reserve(particles);
+        this->top.reserve(particles);
+        this->size.reserve(particles);
+        this->color.reserve(particles);
+
+        const unsigned bands = (unsigned) ((this->height + bandHeight - 1) / bandHeight);
+        this->bandStart.reserve(bands + 1);
+        this->bandEnd.reserve(bands + 1);
+        // A particle smaller than a band touches at most two of them.
+        this->bandParticles.reserve(2 * particles);
+    }
+
+    /** Draw the bands across the cores, or on the calling thread with nullptr. */
+    void setJobSystem(JobSystem *jobs) {
+        this->jobs = jobs;
+    }
+
+    void setBlend(Blend blend) {
+        this->blend = blend;
+    }
+
+    /**
+     * With a falloff, the particles are discs fading out from their center. Without, they are
+     * solid squares, the same pixels as PP::render_pixel.
+     */
+    void setFalloff(bool falloff) {
+        if (falloff != this->falloff) this->kernels.clear();
+        this->falloff = falloff;
+    }
+
+    /** Fill the whole buffer with the given color, as ARGB. */
+    void clear(uint32_t argb) {
+        uint32_t *out = this->pixels.data();
+        const size_t count = this->pixels.size();
+        for (size_t i = 0; i < count; i++) {
+            out[i] = argb;
+        }
+    }
+
+    /**
+     * Draw the particles of a snapshot.
+     *
+     * @param alpha: how far between the previous and the last positions to draw them.
+     */
+    void draw(const phygine::ParticleSnapshot &snapshot, float alpha = 1) {
+        this->_project(snapshot, alpha);
+        const unsigned count = (unsigned) this->left.size();
+        if (count == 0) return;
+
+        if (this->jobs == nullptr || this->jobs->getWorkerCount() == 1) {
+            for (unsigned i = 0; i < count; i++) {
+                this->_splat(i, 0, this->height);
+            }
+        } else {
+            this->_bin();
+            const unsigned bands = (unsigned) this->bandStart.size() - 1;
+            this->jobs->parallelFor(0, bands, 1, [this](unsigned begin, unsigned end) {
+                for (unsigned band = begin; band < end; band++) {
+                    const int top = (int) band * bandHeight;
+                    const int bottom = top + bandHeight < this->height ? top + bandHeight : this->height;
+                    for (unsigned i = this->bandStart[band]; i < this->bandStart[band + 1]; i++) {
+                        this->_splat(this->bandParticles[i], top, bottom);
+                    }
+                }
+            });
+        }
+        this->pixelsTouched += this->_coverage();
+    }
+
+    /** Number of particles of the last draw that were on screen. */
+    unsigned getDrawnCount() const {
+        return (unsigned) this->left.size();
+    }
+
+    /** Number of particle pixels blended since the last call, to compute the fill rate. */
+    unsigned long long takePixelsTouched() {
+        const unsigned long long touched = this->pixelsTouched;
+        this->pixelsTouched = 0;
+        return touched;
+    }
+
+private:
+    /** Rows per band of the parallel draw. */
+    const static int bandHeight = 32;
+
+    int width = 0;
+    int height = 0;
+    std::vector<uint32_t> pixels;
+
+    JobSystem *jobs = nullptr;
+    Blend blend = OVER;
+    bool falloff = true;
+    unsigned long long pixelsTouched = 0;
+
+    /** The particles on screen: top left corner, size, color as ARGB. Kept to reuse the memory. */
+    std::vector<int> left, top;
+    std::vector<uint8_t> size;
+    std::vector<uint32_t> color;
+
+    /** The particles touching each band, in order: band b holds [bandStart[b], bandStart[b + 1]). */
+    std::vector<unsigned> bandStart;
+    std::vector<unsigned> bandParticles;
+    /** Where the next particle of each band goes, while sorting. */
+    std::vector<unsigned> bandEnd;
+
+    /** Coverage of a square of each size, size * size weights out of 256. Built on first use. */
+    std::vector<std::vector<uint16_t>> kernels;
+
+    /** Screen positions of the particles, leaving out those entirely off screen. */
+    void _project(const phygine::ParticleSnapshot &snapshot, float alpha) {
+        const unsigned count = snapshot.count();
+        this->left.resize(count);
+        this->top.resize(count);
+        this->size.resize(count);
+        this->color.resize(count);
+
+        unsigned out = 0;
+        int lastSize = -1;
+        for (unsigned i = 0; i < count; i++) {
+            const float x = snapshot.previousX[i] + (snapshot.x[i] - snapshot.previousX[i]) * alpha;
+            const float y = snapshot.previousY[i] + (snapshot.y[i] - snapshot.previousY[i]) * alpha;
+            // Truncated like the rects of PP::render_pixel.
+            const int l = this->width - (int) x;
+            const int t = this->height - (int) y;
+            const int s = snapshot.size[i];
+            if (s == 0 || l >= this->width || t >= this->height || l + s <= 0 || t + s <= 0) continue;
+
+            // Built here, so that the workers only read the kernels.
+            if (s != lastSize) {
+                this->_kernel((unsigned) s);
+                lastSize = s;
+            }
+
+            const uint32_t rgba = snapshot.color[i];
+            this->left[out] = l;
+            this->top[out] = t;
+            this->size[out] = (uint8_t) s;
+            this->color[out] = (rgba & 0xFF) << 24 | rgba >> 8;
+            out++;
+        }
+
+        this->left.resize(out);
+        this->top.resize(out);
+        this->size.resize(out);
+        this->color.resize(out);
+    }
+
+    /** Sort the particles into the bands they touch, keeping their order: a counting sort. */
+    void _bin() {
+        const unsigned bands = (unsigned) ((this->height + bandHeight - 1) / bandHeight);
+        const unsigned count = (unsigned) this->left.size();
+
+        this->bandStart.assign(bands + 1, 0);
+        for (unsigned i = 0; i < count; i++) {
+            for (unsigned band = _firstBand(i); band <= _lastBand(i, bands); band++) {
+                this->bandStart[band + 1]++;
+            }
+        }
+        for (unsigned band = 0; band < bands; band++) {
+            this->bandStart[band + 1] += this->bandStart[band];
+        }
+
+        this->bandParticles.resize(this->bandStart[bands]);
+        this->bandEnd.assign(this->bandStart.begin(), this->bandStart.end() - 1);
+        for (unsigned i = 0; i < count; i++) {
+            for (unsigned band = _firstBand(i); band <= _lastBand(i, bands); band++) {
+                this->bandParticles[this->bandEnd[band]++] = i;
+            }
+        }
+    }
+
+    unsigned _firstBand(unsigned i) const {
+        return (unsigned) (this->top[i] > 0 ? this->top[i] : 0) / bandHeight;
+    }
+
+    unsigned _lastBand(unsigned i, unsigned bands) const {
+        const unsigned last = (unsigned) (this->top[i] + this->size[i] - 1) / bandHeight;
+        return last < bands ? last : bands - 1;
+    }
+
+    const uint16_t *_kernel(unsigned size) {
+        if (size >= this->kernels.size()) this->kernels.resize(size + 1);
+        std::vector<uint16_t> &kernel = this->kernels[size];
+        if (!kernel.empty()) return kernel.data();
+
+        kernel.resize(size * size);
+        const float radius = size * 0.5f;
+        for (unsigned row = 0; row < size; row++) {
+            for (unsigned column = 0; column < size; column++) {
+                float weight = 1;
+                if (this->falloff) {
+                    // Sampled at the pixel centers: (1 - d^2 / r^2)^2, smooth down to 0 at the rim.
+                    const float dx = column + 0.5f - radius, dy = row + 0.5f - radius;
+                    const float fade = 1 - (dx * dx + dy * dy) / (radius * radius);
+                    weight = fade > 0 ? fade * fade : 0;
+                }
+                kernel[row * size + column] = (uint16_t) (weight * 256 + 0.5f);
+            }
+        }
+        return kernel.data();
+    }
+
+    /** Blend particle i into the rows [rowBegin, rowEnd). */
+    void _splat(unsigned i, int rowBegin, int rowEnd) {
+        const int s = this->size[i];
+        const int l = this->left[i], t = this->top[i];
+        const int x0 = l > 0 ? l : 0;
+        const int x1 = l + s < this->width ? l + s : this->width;
+        const int y0 = t > rowBegin ? t : rowBegin;
+        const int y1 = t + s < rowEnd ? t + s : rowEnd;
+        if (x0 >= x1 || y0 >= y1) return;
+
+        const uint16_t *kernel = this->kernels[s].data();
+        const uint32_t argb = this->color[i];
+        // The particle alpha scales the weights, from 0 to 256.
+        const uint32_t opacity = (argb >> 24) + (argb >> 31);
+        // Two channels per 32 bits integer, 16 bits apart, so that one multiply weights both:
+        // red and blue, then alpha and green. The painted alpha is opaque, the coverage fades it.
+        const uint32_t sourceRB = argb & 0x00FF00FF;
+        const uint32_t sourceAG = argb >> 8 & 0x00FF00FF;
+        const uint32_t opaqueAG = 0x00FF0000 | (argb >> 8 & 0xFF);
+
+        const int n = x1 - x0;
+
+        for (int y = y0; y < y1; y++) {
+            uint32_t *__restrict row = this->pixels.data() + (size_t) y * this->width + x0;
+            const uint16_t *__restrict weights = kernel + (y - t) * s + (x0 - l);
+
+            // Branchless, so that wide particles vectorise.
+            if (this->blend == ADD) {
+                for (int x = 0; x < n; x++) {
+                    const uint32_t w = weights[x] * opacity >> 8;
+                    const uint32_t p = row[x];
+                    uint32_t rb = (p & 0x00FF00FF) + (sourceRB * w >> 8 & 0x00FF00FF);
+                    uint32_t ag = (p >> 8 & 0x00FF00FF) + (sourceAG * w >> 8 & 0x00FF00FF);
+                    // Saturate: a channel over 255 carried into bit 8 of its half, which turns
+                    // into a mask of 255.
+                    rb |= 0x01000100 - (rb >> 8 & 0x00010001);
+                    ag |= 0x01000100 - (ag >> 8 & 0x00010001);
+                    row[x] = (rb & 0x00FF00FF) | (ag & 0x00FF00FF) << 8;
+                }
+            } else {
+                for (int x = 0; x < n; x++) {
+                    const uint32_t w = weights[x] * opacity >> 8;
+                    const uint32_t p = row[x];
+                    // p * (1 - w) + source * w, at most 255 * 256 per channel: no carry.
+                    const uint32_t rb = ((p & 0x00FF00FF) * (256 - w) + sourceRB * w) >> 8;
+                    const uint32_t ag = ((p >> 8 & 0x00FF00FF) * (256 - w) + opaqueAG * w) >> 8;
+                    row[x] = (rb & 0x00FF00FF) | (ag & 0x00FF00FF) << 8;
+                }
+            }
+        }
+    }
+
+    /** Pixels covered by the particles, clipped to the screen. */
+    unsigned long long _coverage() const {
+        unsigned long long covered = 0;
+        const unsigned count = (unsigned) this->left.size();
+        for (unsigned i = 0; i < count; i++) {
+            const int s = this->size[i];
+            const int x0 = this->left[i] > 0 ? this->left[i] : 0;
+            const int x1 = this->left[i] + s < this->width ? this->left[i] + s : this->width;
+            const int y0 = this->top[i] > 0 ? this->top[i] : 0;
+            const int y1 = this->top[i] + s < this->height ? this->top[i] + s : this->height;
+            covered += (unsigned long long) (x1 - x0) * (y1 - y0);
+        }
+        return covered;
+    }
+};
+
+#endif // PARTICLE_RASTER_CPP
@@ -0,0 +1,325 @@
+#ifndef PROFILER_CPP
+#define PROFILER_CPP
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include <SDL.h>
+
+#include "Stats.cpp"
+
+/**
+ * Measures where the frame time goes.
+ *
+ * Code is split in named scopes (PROFILE_SCOPE), timed with the high resolution performance
+ * counter. Phases of the frame (events, update, render...) are top level scopes, and must not
+ * overlap. Any part of a phase can be timed on its own as a sub-scope (PROFILE_SUBSCOPE). The time
+ * of every scope is summed over the frame, and endFrame() pushes a record of the frame in a ring,
+ * along with the number of live particles and of pixels touched. From the ring we get rolling
+ * percentiles per scope, a small on screen overlay, and a CSV dump.
+ *
+ * Scopes may be timed from any thread (simulation thread, job workers). beginFrame, endFrame and
+ * the readers are meant for the main thread. The ring is written without lock: a reader on
+ * another thread only has to skip the oldest record, which may be being overwritten.
+ */
+class Profiler {
+public:
+    /** Maximum number of distinct scopes. */
+    const static unsigned MAX_SCOPES = 16;
+
+    /** Number of frames kept in the ring. */
+    const static unsigned HISTORY = 512;
+
+    struct FrameRecord {
+        unsigned long long frame;
+        /** Whole frame duration, in performance counter ticks. */
+        Uint64 total;
+        /** Time spent in each scope during the frame, in performance counter ticks. */
+        Uint64 scopes[MAX_SCOPES];
+        unsigned liveParticles;
+        /** Pixels cleared and drawn again by the render. */
+        unsigned long long pixelsTouched;
+        /** Heap allocations made during the frame, see AllocationTracker. */
+        unsigned long long allocations;
+        /** Particles drawn, and skipped as out of view, by the render. */
+        unsigned drawnParticles;
+        unsigned culledParticles;
+    };
+
+    static Profiler &getInstance() {
+        static Profiler instance;
+        return instance;
+    }
+
+    Profiler(Profiler const &) = delete;
+    void operator=(Profiler const &) = delete;
+
+    /**
+     * Get the id of the scope of the given name, registering it the first time. The name must
+     * outlive the profiler (a literal). Returns MAX_SCOPES - 1 once all the scopes are taken.
+     *
+     * @param sub: whether the scope is part of another one.
+     */
+    unsigned scope(const char *name, bool sub = false) {
+        std::lock_guard<std::mutex> lock(scopeMutex);
+
+        for (unsigned i = 0; i < scopeCount; i++) {
+            if (strcmp(names[i], name) == 0) return i;
+        }
+        if (scopeCount == MAX_SCOPES) return MAX_SCOPES - 1;
+
+        names[scopeCount] = name;
+        subScopes[scopeCount] = sub;
+        return scopeCount++;
+    }
+
+    const char *scopeName(unsigned id) const {
+        return names[id];
+    }
+
+    unsigned getScopeCount() const {
+        return scopeCount;
+    }
+
+    /** Means no scope is open, see currentScope. */
+    const static unsigned NO_SCOPE = MAX_SCOPES;
+
+    /**
+     * The innermost scope open on the calling thread, or NO_SCOPE. Used to attribute the heap
+     * allocations to the scopes, see AllocationTracker. Does not need the profiler instance, so
+     * it may be called from operator new.
+     */
+    static unsigned &currentScope() {
+        static thread_local unsigned scope = NO_SCOPE;
+        return scope;
+    }
+
+    /** Add some time to a scope of the current frame. */
+    void add(unsigned id, Uint64 ticks) {
+        current[id].fetch_add(ticks, std::memory_order_relaxed);
+    }
+
+    void beginFrame() {
+        frameStart = SDL_GetPerformanceCounter();
+    }
+
+    /** Close the current frame and push its record in the ring. */
+    void endFrame(unsigned liveParticles, unsigned long long pixelsTouched = 0, unsigned long long allocations = 0,
+                  unsigned drawnParticles = 0, unsigned culledParticles = 0) {
+        const unsigned long long index = written.load(std::memory_order_relaxed);
+        FrameRecord &record = records[index % HISTORY];
+
+        record.frame = index;
+        record.total = SDL_GetPerformanceCounter() - frameStart;
+        for (unsigned i = 0; i < MAX_SCOPES; i++) {
+            record.scopes[i] = current[i].exchange(0, std::memory_order_relaxed);
+        }
+        record.liveParticles = liveParticles;
+        record.pixelsTouched = pixelsTouched;
+        record.allocations = allocations;
+        record.drawnParticles = drawnParticles;
+        record.culledParticles = culledParticles;
+
+        written.store(index + 1, std::memory_order_release);
+    }
+
+    /** Number of frames recorded so far. */
+    unsigned long long frameCount() const {
+        return written.load(std::memory_order_acquire);
+    }
+
+    /** Get the record of the given frame, which must be one of the last HISTORY ones. */
+    const FrameRecord &record(unsigned long long frame) const {
+        return records[frame % HISTORY];
+    }
+
+    /** Rolling percentiles of a scope over the recorded frames, in milliseconds. */
+    Percentiles scopePercentiles(unsigned id) {
+        return _percentiles([id](const FrameRecord &record) { return record.scopes[id]; });
+    }
+
+    /** Rolling percentiles of the whole frame duration, in milliseconds. */
+    Percentiles framePercentiles() {
+        return _percentiles([](const FrameRecord &record) { return record.total; });
+    }
+
+    bool overlayEnabled = false;
+
+    /** The frame budget drawn on the overlay, in milliseconds. */
+    double budgetMs = 1000.0 / 60;
+
+    /** Where renderOverlay draws, to redraw it every frame with dirty regions. */
+    SDL_Rect overlayBounds() const {
+        return {0, 0, overlayFrames * overlayColumnWidth, overlayGraphHeight + 8 * (int) scopeCount + 4};
+    }
+
+    /**
+     * Draw the recorded frames over the screen. There is no text rendering, so this is bars only:
+     *  - at the top, one column per frame of the history, stacked by top level scope (2 px per
+     *    ms), with a black line at the frame budget,
+     *  - below, one row per scope: p50 as a solid bar, p95 and p99 as ticks (10 px per ms).
+     * Scope colors are fixed by id, in the order they were registered. The background is
+     * translucent: the overlay blends, and restores the draw blend mode of the renderer.
+     */
+    void renderOverlay(SDL_Renderer *renderer) {
+        static const Uint8 colors[][3] = {
+                {0x33, 0x66, 0xCC}, {0xDC, 0x39, 0x12}, {0xFF, 0x99, 0x00}, {0x10, 0x96, 0x18},
+                {0x99, 0x00, 0x99}, {0x00, 0x99, 0xC6}, {0xDD, 0x44, 0x77}, {0x66, 0xAA, 0x00},
+        };
+        const unsigned colorCount = sizeof(colors) / sizeof(colors[0]);
+        const int graphHeight = overlayGraphHeight, columnWidth = overlayColumnWidth, msToGraph = 2, msToBar = 10;
+        const double msPerTick = 1000.0 / SDL_GetPerformanceFrequency();
+
+        const unsigned long long count = frameCount();
+        const unsigned long long shown = count < overlayFrames ? count : overlayFrames;
+
+        SDL_BlendMode blendMode = SDL_BLENDMODE_NONE;
+        SDL_GetRenderDrawBlendMode(renderer, &blendMode);
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+
+        SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xC0);
+        const SDL_Rect background = overlayBounds();
+        SDL_RenderFillRect(renderer, &background);
+
+        for (unsigned id = 0; id < scopeCount; id++) {
+            const Uint8 *color = colors[id % colorCount];
+            SDL_SetRenderDrawColor(renderer, color[0], color[1], color[2], 0xFF);
+
+            // Frame history, this scope stacked over the previous ones.
+            for (unsigned long long i = 0; i < shown && !subScopes[id]; i++) {
+                const FrameRecord &frame = record(count - shown + i);
+
+                double below = 0;
+                for (unsigned other = 0; other < id; other++) {
+                    if (!subScopes[other]) below += frame.scopes[other] * msPerTick;
+                }
+                const int height = (int) (frame.scopes[id] * msPerTick * msToGraph);
+                SDL_Rect column = {(int) i * columnWidth, graphHeight - (int) (below * msToGraph) - height,
+                                   columnWidth, height};
+                SDL_RenderFillRect(renderer, &column);
+            }
+
+            // Percentiles of the scope.
+            const Percentiles p = scopePercentiles(id);
+            const int y = graphHeight + 4 + 8 * (int) id;
+            SDL_Rect bar = {0, y, (int) (p.p50 * msToBar), 6};
+            SDL_Rect p95 = {(int) (p.p95 * msToBar), y, 2, 6};
+            SDL_Rect p99 = {(int) (p.p99 * msToBar), y, 1, 6};
+            SDL_RenderFillRect(renderer, &bar);
+            SDL_RenderFillRect(renderer, &p95);
+            SDL_RenderFillRect(renderer, &p99);
+        }
+
+        SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);
+        SDL_Rect budget = {0, graphHeight - (int) (budgetMs * msToGraph), overlayFrames * columnWidth, 1};
+        SDL_RenderFillRect(renderer, &budget);
+
+        SDL_SetRenderDrawBlendMode(renderer, blendMode);
+    }
+
+    /**
+     * Write the recorded frames as CSV: frame, total, one column per scope (all in ms), the
+     * number of live particles and of pixels touched. Returns false if the file could not be written.
+     */
+    bool dumpCsv(const char *path) const {
+        FILE *file = fopen(path, "w");
+        if (file == nullptr) {
+            SDL_Log("Could not write the profile to %s\n", path);
+            return false;
+        }
+
+        fprintf(file, "frame,total_ms");
+        for (unsigned id = 0; id < scopeCount; id++) {
+            fprintf(file, ",%s_ms", names[id]);
+        }
+        fprintf(file, ",live_particles,pixels_touched,allocations,drawn_particles,culled_particles\n");
+
+        const double msPerTick = 1000.0 / SDL_GetPerformanceFrequency();
+        const unsigned long long count = frameCount();
+        const unsigned long long first = count > HISTORY - 1 ? count - (HISTORY - 1) : 0;
+
+        for (unsigned long long i = first; i < count; i++) {
+            const FrameRecord &frame = record(i);
+            fprintf(file, "%llu,%.4f", frame.frame, frame.total * msPerTick);
+            for (unsigned id = 0; id < scopeCount; id++) {
+                fprintf(file, ",%.4f", frame.scopes[id] * msPerTick);
+            }
+            fprintf(file, ",%u,%llu,%llu,%u,%u\n", frame.liveParticles, frame.pixelsTouched, frame.allocations,
+                    frame.drawnParticles, frame.culledParticles);
+        }
+
+        fclose(file);
+        return true;
+    }
+
+private:
+    /** Frames shown by the overlay, width of their columns and height of the graph, in px. */
+    const static int overlayFrames = 150;
+    const static int overlayColumnWidth = 2;
+    const static int overlayGraphHeight = 80;
+
+    const char *names[MAX_SCOPES] = {};
+    bool subScopes[MAX_SCOPES] = {};
+    unsigned scopeCount = 0;
+    std::mutex scopeMutex;
+
+    /** Time spent in each scope during the current frame. */
+    std::atomic<Uint64> current[MAX_SCOPES] = {};
+    Uint64 frameStart = 0;
+
+    FrameRecord records[HISTORY] = {};
+    std::atomic<unsigned long long> written{0};
+
+    std::vector<double> scratch = std::vector<double>(HISTORY);
+
+    template<typename Field>
+    Percentiles _percentiles(Field field) {
+        const double msPerTick = 1000.0 / SDL_GetPerformanceFrequency();
+        const unsigned long long count = frameCount();
+        const unsigned long long first = count > HISTORY - 1 ? count - (HISTORY - 1) : 0;
+
+        scratch.clear();
+        for (unsigned long long i = first; i < count; i++) {
+            scratch.push_back(field(record(i)) * msPerTick);
+        }
+        return Percentiles::of(scratch);
+    }
+
+    Profiler() = default;
+};
+
+/** Adds the time spent between its construction and its destruction to a profiler scope. */
+class ScopedTimer {
+public:
+    explicit ScopedTimer(unsigned id) : id(id), parent(Profiler::currentScope()), start(SDL_GetPerformanceCounter()) {
+        Profiler::currentScope() = id;
+    }
+
+    ~ScopedTimer() {
+        Profiler::getInstance().add(id, SDL_GetPerformanceCounter() - start);
+        Profiler::currentScope() = parent;
+    }
+
+private:
+    unsigned id;
+    unsigned parent;
+    Uint64 start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+/** Time the rest of the enclosing block into the top level scope of the given name (a literal). */
+#define PROFILE_SCOPE(name) \
+    static const unsigned PROFILE_CONCAT(profileScope, __LINE__) = Profiler::getInstance().scope(name); \
+    ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(PROFILE_CONCAT(profileScope, __LINE__))
+
+/** Time the rest of the enclosing block into the sub-scope of the given name (a literal). */
+#define PROFILE_SUBSCOPE(name) \
+    static const unsigned PROFILE_CONCAT(profileScope, __LINE__) = Profiler::getInstance().scope(name, true); \
+    ScopedTimer PROFILE_CONCAT(profileTimer, __LINE__)(PROFILE_CONCAT(profileScope, __LINE__))
+
+#endif // PROFILER_CPP
@@ -0,0 +1,130 @@
+#ifndef SPRITE_BATCH_CPP
+#define SPRITE_BATCH_CPP
+
+#include <algorithm>
+#include <vector>
+
+#include <SDL.h>
+
+/** A region of a texture: a whole image, or one image of an atlas. */
+struct Sprite {
+    SDL_Texture *texture = nullptr;
+    SDL_Rect source = {0, 0, 0, 0};
+};
+
+/**
+ * Collects the sprite draws of a frame, and submits them grouped by texture.
+ *
+ * The draws are sorted by layer, then by texture, then in the order they were made. Sprites of
+ * one layer are expected not to overlap across textures: their relative order is lost. With SDL
+ * 2.0.18 or later, each texture of each layer costs a single SDL_RenderGeometry call, so an atlas
+ * costs one call whatever the number of sprites. Before that, each sprite is one SDL_RenderCopy,
+ * still grouped by texture to spare the texture switches.
+ */
+class SpriteBatch {
+public:
+    /** Queue the given part of a texture, drawn on the given rectangle of the screen. */
+    void draw(SDL_Texture *texture, const SDL_Rect &source, const SDL_Rect &destination, int layer = 0) {
+        if (texture == nullptr) return;
+        draws.push_back({layer, texture, static_cast<unsigned>(draws.size()), source, destination});
+    }
+
+    void draw(const Sprite &sprite, const SDL_Rect &destination, int layer = 0) {
+        draw(sprite.texture, sprite.source, destination, layer);
+    }
+
+    /** Number of draws queued. */
+    unsigned size() const {
+        return static_cast<unsigned>(draws.size());
+    }
+
+    /** Number of render calls made by the last flush. */
+    unsigned getSubmits() const {
+        return submits;
+    }
+
+    /** Draw every queued sprite, and empty the batch. */
+    void flush(SDL_Renderer *renderer) {
+        submits = 0;
+        if (draws.empty()) return;
+
+        // The sequence number makes the order total, so no need for a stable (allocating) sort.
+        std::sort(draws.begin(), draws.end(), [](const Draw &a, const Draw &b) {
+            if (a.layer != b.layer) return a.layer < b.layer;
+            if (a.texture != b.texture) return a.texture < b.texture;
+            return a.sequence < b.sequence;
+        });
+
+        size_t begin = 0;
+        while (begin < draws.size()) {
+            size_t end = begin + 1;
+            while (end < draws.size() && draws[end].texture == draws[begin].texture && draws[end].layer == draws[begin].layer) {
+                end++;
+            }
+            _submit(renderer, begin, end);
+            begin = end;
+        }
+
+        draws.clear();
+    }
+
+private:
+    struct Draw {
+        int layer;
+        SDL_Texture *texture;
+        unsigned sequence;
+        SDL_Rect source;
+        SDL_Rect destination;
+    };
+
+    std::vector<Draw> draws;
+    unsigned submits = 0;
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    std::vector<SDL_Vertex> vertices;
+    std::vector<int> indices;
+
+    /** Draw the given range of draws, which share their texture, in one call. */
+    void _submit(SDL_Renderer *renderer, size_t begin, size_t end) {
+        SDL_Texture *texture = draws[begin].texture;
+        int width = 1, height = 1;
+        SDL_QueryTexture(texture, nullptr, nullptr, &width, &height);
+        const float u = 1.0f / width, v = 1.0f / height;
+        const SDL_Color white = {0xFF, 0xFF, 0xFF, 0xFF};
+
+        vertices.clear();
+        indices.clear();
+        for (size_t i = begin; i < end; i++) {
+            const SDL_Rect &source = draws[i].source;
+            const SDL_Rect &destination = draws[i].destination;
+            const int first = static_cast<int>(vertices.size());
+
+            const float x0 = (float) destination.x, y0 = (float) destination.y;
+            const float x1 = (float) (destination.x + destination.w), y1 = (float) (destination.y + destination.h);
+            const float u0 = source.x * u, v0 = source.y * v;
+            const float u1 = (source.x + source.w) * u, v1 = (source.y + source.h) * v;
+
+            vertices.push_back({{x0, y0}, white, {u0, v0}});
+            vertices.push_back({{x1, y0}, white, {u1, v0}});
+            vertices.push_back({{x1, y1}, white, {u1, v1}});
+            vertices.push_back({{x0, y1}, white, {u0, v1}});
+
+            const int quad[6] = {first, first + 1, first + 2, first, first + 2, first + 3};
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+
+        SDL_RenderGeometry(renderer, texture, vertices.data(), static_cast<int>(vertices.size()),
+                           indices.data(), static_cast<int>(indices.size()));
+        submits++;
+    }
+#else
+    void _submit(SDL_Renderer *renderer, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            SDL_RenderCopy(renderer, draws[i].texture, &draws[i].source, &draws[i].destination);
+            submits++;
+        }
+    }
+#endif
+};
+
+#endif // SPRITE_BATCH_CPP
@@ -0,0 +1,77 @@
+#ifndef STATS_CPP
+#define STATS_CPP
+
+#include <algorithm>
+#include <vector>
+
+/** Distribution summary of a set of samples. */
+struct Percentiles {
+    double p50 = 0;
+    double p95 = 0;
+    double p99 = 0;
+    double max = 0;
+    double mean = 0;
+    unsigned count = 0;
+
+    /**
+     * Compute the percentiles of the given samples. The samples are reordered (partially sorted),
+     * but no memory is allocated.
+     */
+    static Percentiles of(std::vector<double> &samples) {
+        Percentiles result;
+        result.count = static_cast<unsigned>(samples.size());
+        if (samples.empty()) return result;
+
+        double sum = 0;
+        for (double sample : samples) {
+            sum += sample;
+        }
+        result.mean = sum / samples.size();
+
+        result.p50 = _nth(samples, 0.50);
+        result.p95 = _nth(samples, 0.95);
+        result.p99 = _nth(samples, 0.99);
+        result.max = *std::max_element(samples.begin(), samples.end());
+        return result;
+    }
+
+private:
+    static double _nth(std::vector<double> &samples, double fraction) {
+        const size_t n = static_cast<size_t>(fraction * (samples.size() - 1) + 0.5);
+        std::nth_element(samples.begin(), samples.begin() + n, samples.end());
+        return samples[n];
+    }
+};
+
+/** Keeps the last samples of a measure, to get its percentiles over a rolling window. */
+class RollingSamples {
+public:
+    explicit RollingSamples(unsigned capacity = 512) : samples(capacity), scratch() {
+        scratch.reserve(capacity);
+    }
+
+    void add(double sample) {
+        samples[written % samples.size()] = sample;
+        written++;
+    }
+
+    unsigned count() const {
+        return written < samples.size() ? static_cast<unsigned>(written) : static_cast<unsigned>(samples.size());
+    }
+
+    void clear() {
+        written = 0;
+    }
+
+    Percentiles percentiles() {
+        scratch.assign(samples.begin(), samples.begin() + count());
+        return Percentiles::of(scratch);
+    }
+
+private:
+    std::vector<double> samples;
+    std::vector<double> scratch;
+    unsigned long long written = 0;
+};
+
+#endif // STATS_CPP
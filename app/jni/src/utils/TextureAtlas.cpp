@@ -0,0 +1,191 @@
+#ifndef TEXTURE_ATLAS_CPP
+#define TEXTURE_ATLAS_CPP
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <SDL.h>
+#include <SDL_image.h>
+
+#include "SpriteBatch.cpp"
+#include "TextureCache.cpp"
+
+/**
+ * Packs rectangles into a fixed size area, in shelves: rows as high as their highest rectangle,
+ * filled from left to right. Simple and fast, and good enough when the rectangles are added from
+ * the highest to the lowest.
+ */
+class ShelfPacker {
+public:
+    /**
+     * @param padding: space kept between the rectangles, so that filtering does not bleed one
+     *  sprite into its neighbours.
+     */
+    ShelfPacker(int width, int height, int padding = 1) : width(width), height(height), padding(padding) {}
+
+    /**
+     * Find room for a rectangle of the given size. Returns false, leaving position untouched, if
+     * there is none.
+     */
+    bool pack(int w, int h, SDL_Rect &position) {
+        const int paddedW = w + padding, paddedH = h + padding;
+
+        // The shelf that fits and wastes the least height.
+        Shelf *best = nullptr;
+        for (Shelf &shelf : shelves) {
+            if (shelf.height >= paddedH && shelf.used + paddedW <= width &&
+                (best == nullptr || shelf.height < best->height)) {
+                best = &shelf;
+            }
+        }
+
+        if (best == nullptr) {
+            if (top + paddedH > height || paddedW > width) return false;
+            shelves.push_back({top, paddedH, 0});
+            top += paddedH;
+            best = &shelves.back();
+        }
+
+        position = {best->used, best->y, w, h};
+        best->used += paddedW;
+        area += w * h;
+        return true;
+    }
+
+    void reset() {
+        shelves.clear();
+        top = 0;
+        area = 0;
+    }
+
+    /** Fraction of the area covered by the packed rectangles. */
+    float occupancy() const {
+        return (float) area / ((float) width * height);
+    }
+
+private:
+    struct Shelf {
+        int y;
+        int height;
+        /** Width already taken in the shelf. */
+        int used;
+    };
+
+    int width;
+    int height;
+    int padding;
+    std::vector<Shelf> shelves;
+    int top = 0;
+    long long area = 0;
+};
+
+/**
+ * Many small images in a single texture, so that the sprite batch draws all of them in one call.
+ *
+ * Images are added by path, then build() packs them, uploads the atlas once and frees the
+ * images. The atlas texture goes into the texture cache under "atlas:" and the atlas name.
+ */
+class TextureAtlas {
+public:
+    explicit TextureAtlas(std::string name, int width = 1024, int height = 1024)
+            : name(std::move(name)), packer(width, height), width(width), height(height) {}
+
+    ~TextureAtlas() {
+        for (Pending &image : pending) {
+            SDL_FreeSurface(image.surface);
+        }
+    }
+
+    TextureAtlas(TextureAtlas const &) = delete;
+    void operator=(TextureAtlas const &) = delete;
+
+    /** Load an image to be packed at the next build. Returns false if it could not be loaded. */
+    bool add(const std::string &path) {
+        SDL_Surface *surface = IMG_Load(path.c_str());
+        if (surface == nullptr) {
+            SDL_Log("Could not load %s: %s\n", path.c_str(), SDL_GetError());
+            return false;
+        }
+        pending.push_back({path, surface});
+        return true;
+    }
+
+    /**
+     * Pack the added images and upload the atlas. Images that do not fit are logged and left out.
+     * Returns false if the atlas could not be created.
+     */
+    bool build(SDL_Renderer *renderer) {
+        // Highest first, for tighter shelves.
+        std::sort(pending.begin(), pending.end(), [](const Pending &a, const Pending &b) {
+            return a.surface->h > b.surface->h;
+        });
+
+        SDL_Surface *atlas = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+        if (atlas == nullptr) {
+            SDL_Log("Could not create the atlas %s: %s\n", name.c_str(), SDL_GetError());
+            return false;
+        }
+
+        packer.reset();
+        regions.clear();
+        for (Pending &image : pending) {
+            SDL_Rect position;
+            if (packer.pack(image.surface->w, image.surface->h, position)) {
+                // Copy the pixels as they are, alpha included, instead of blending them.
+                SDL_SetSurfaceBlendMode(image.surface, SDL_BLENDMODE_NONE);
+                SDL_BlitSurface(image.surface, nullptr, atlas, &position);
+                regions[image.path] = position;
+            } else {
+                SDL_Log("No room left in the atlas %s for %s\n", name.c_str(), image.path.c_str());
+            }
+            SDL_FreeSurface(image.surface);
+        }
+        pending.clear();
+
+        SDL_Texture *created = SDL_CreateTextureFromSurface(renderer, atlas);
+        SDL_FreeSurface(atlas);
+        if (created == nullptr) {
+            SDL_Log("Could not create the texture of the atlas %s: %s\n", name.c_str(), SDL_GetError());
+            return false;
+        }
+        SDL_SetTextureBlendMode(created, SDL_BLENDMODE_BLEND);
+
+        texture = TextureCache::getInstance().adopt("atlas:" + name, created, width, height);
+        return true;
+    }
+
+    /** Get the sprite of an image of the atlas, with a null texture if it is not in. */
+    Sprite find(const std::string &path) const {
+        Sprite sprite;
+        auto found = regions.find(path);
+        if (found != regions.end() && texture) {
+            sprite.texture = texture.get();
+            sprite.source = found->second;
+        }
+        return sprite;
+    }
+
+    float occupancy() const {
+        return packer.occupancy();
+    }
+
+private:
+    struct Pending {
+        std::string path;
+        SDL_Surface *surface;
+    };
+
+    std::string name;
+    ShelfPacker packer;
+    int width;
+    int height;
+
+    std::vector<Pending> pending;
+    std::unordered_map<std::string, SDL_Rect> regions;
+    TextureHandle texture;
+};
+
+#endif // TEXTURE_ATLAS_CPP
@@ -0,0 +1,184 @@
+#ifndef TEXTURE_CACHE_CPP
+#define TEXTURE_CACHE_CPP
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include <SDL.h>
+#include <SDL_image.h>
+
+class TextureCache;
+
+/**
+ * A shared reference to a texture of the cache. Copying a handle adds a reference, destroying one
+ * removes it; the texture is destroyed with its last handle. An empty handle (the default) holds
+ * no texture.
+ */
+class TextureHandle {
+public:
+    TextureHandle() = default;
+
+    TextureHandle(const TextureHandle &other) : entry(other.entry) {
+        if (entry) entry->references++;
+    }
+
+    TextureHandle(TextureHandle &&other) noexcept : entry(other.entry) {
+        other.entry = nullptr;
+    }
+
+    TextureHandle &operator=(TextureHandle other) {
+        std::swap(entry, other.entry);
+        return *this;
+    }
+
+    ~TextureHandle() {
+        release();
+    }
+
+    /** Drop the reference, leaving the handle empty. */
+    inline void release();
+
+    SDL_Texture *get() const {
+        return entry ? entry->texture : nullptr;
+    }
+
+    int width() const {
+        return entry ? entry->width : 0;
+    }
+
+    int height() const {
+        return entry ? entry->height : 0;
+    }
+
+    explicit operator bool() const {
+        return entry != nullptr;
+    }
+
+private:
+    friend class TextureCache;
+
+    struct Entry {
+        std::string path;
+        SDL_Texture *texture;
+        int width;
+        int height;
+        unsigned references;
+    };
+
+    explicit TextureHandle(Entry *entry) : entry(entry) {
+        entry->references++;
+    }
+
+    Entry *entry = nullptr;
+};
+
+/**
+ * Loads each image once, whoever asks for it. Textures are keyed by their asset path, and live as
+ * long as a handle on them does.
+ *
+ * Textures belong to a renderer: the cache is meant for the one of PP, and must be emptied (every
+ * handle released) before the renderer is destroyed. Main thread only, like the renderer.
+ */
+class TextureCache {
+public:
+    static TextureCache &getInstance() {
+        static TextureCache instance;
+        return instance;
+    }
+
+    TextureCache(TextureCache const &) = delete;
+    void operator=(TextureCache const &) = delete;
+
+    /**
+     * Get the texture of the given image, loading it on first use. Returns an empty handle if it
+     * could not be loaded.
+     */
+    TextureHandle acquire(SDL_Renderer *renderer, const std::string &path) {
+        auto found = entries.find(path);
+        if (found != entries.end()) {
+            hits++;
+            return TextureHandle(&found->second);
+        }
+
+        // The surface is only useful until SDL_CreateTextureFromSurface is called.
+        SDL_Surface *surface = IMG_Load(path.c_str());
+        if (surface == nullptr) {
+            SDL_Log("Could not load %s: %s\n", path.c_str(), SDL_GetError());
+            return TextureHandle();
+        }
+        SDL_Texture *texture = _upload(renderer, surface, path);
+        const int width = surface->w, height = surface->h;
+        SDL_FreeSurface(surface);
+
+        return texture ? adopt(path, texture, width, height) : TextureHandle();
+    }
+
+    /**
+     * Hand a texture created elsewhere (an atlas, an asynchronously loaded image) over to the
+     * cache, under the given key. The cache destroys it with its last handle. If the key is
+     * already taken, the given texture is destroyed and the cached one is returned.
+     */
+    TextureHandle adopt(const std::string &key, SDL_Texture *texture, int width, int height) {
+        auto inserted = entries.emplace(key, TextureHandle::Entry{key, texture, width, height, 0});
+        if (!inserted.second) {
+            SDL_DestroyTexture(texture);
+            hits++;
+        } else {
+            loads++;
+        }
+        return TextureHandle(&inserted.first->second);
+    }
+
+    /** Whether the texture of the given key is loaded. */
+    bool contains(const std::string &key) const {
+        return entries.find(key) != entries.end();
+    }
+
+    /** Number of textures alive. */
+    unsigned size() const {
+        return static_cast<unsigned>(entries.size());
+    }
+
+    /** Number of textures created, and of requests served from the cache, so far. */
+    unsigned getLoads() const {
+        return loads;
+    }
+
+    unsigned getHits() const {
+        return hits;
+    }
+
+private:
+    friend class TextureHandle;
+
+    std::unordered_map<std::string, TextureHandle::Entry> entries;
+    unsigned loads = 0;
+    unsigned hits = 0;
+
+    TextureCache() = default;
+
+    static SDL_Texture *_upload(SDL_Renderer *renderer, SDL_Surface *surface, const std::string &path) {
+        SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, surface);
+        if (texture == nullptr) {
+            SDL_Log("Could not create the texture of %s: %s\n", path.c_str(), SDL_GetError());
+        }
+        return texture;
+    }
+
+    void _release(TextureHandle::Entry *entry) {
+        if (--entry->references > 0) return;
+
+        SDL_DestroyTexture(entry->texture);
+        // Copy the key, which would be destroyed while erasing.
+        const std::string path = entry->path;
+        entries.erase(path);
+    }
+};
+
+void TextureHandle::release() {
+    if (entry) TextureCache::getInstance()._release(entry);
+    entry = nullptr;
+}
+
+#endif // TEXTURE_CACHE_CPP
@@ -0,0 +1,71 @@
+#ifndef TIMESTEP_CPP
+#define TIMESTEP_CPP
+
+#include <math.h>
+
+/**
+ * Turns variable frame durations into a whole number of fixed simulation steps.
+ *
+ * Every frame, the elapsed time is added to an accumulator and consumed in steps of a fixed
+ * duration. What is left (less than one step) is exposed as an interpolation factor, so the
+ * render can blend between the previous and the current simulation state.
+ */
+class FixedTimestep {
+public:
+    /**
+     * @param step: duration of one simulation step, in seconds.
+     * @param maxSteps: maximum number of steps run for one frame. When the simulation cannot keep
+     *  up, the time that does not fit is dropped instead of piling up (the "spiral of death").
+     */
+    FixedTimestep(float step, unsigned maxSteps) : step(step), maxSteps(maxSteps) {}
+
+    /**
+     * Add the duration of the last frame, and return how many steps must be simulated to catch up.
+     *
+     * @param frameDuration: time elapsed since the last call, in seconds.
+     */
+    unsigned advance(float frameDuration) {
+        accumulator += frameDuration;
+
+        unsigned steps = 0;
+        while (accumulator >= step && steps < maxSteps) {
+            accumulator -= step;
+            steps++;
+        }
+
+        if (steps == maxSteps && accumulator >= step) {
+            // We are late: forget about the extra time, but keep the fraction for the interpolation.
+            droppedTime += accumulator - fmodf(accumulator, step);
+            accumulator = fmodf(accumulator, step);
+        }
+
+        return steps;
+    }
+
+    /** How far we are between the last simulated state and the next one, in [0, 1). */
+    float alpha() const {
+        return accumulator / step;
+    }
+
+    float getStep() const {
+        return step;
+    }
+
+    void setStep(float step) {
+        this->step = step;
+    }
+
+    /** Total simulated time that has been dropped because we could not keep up, in seconds. */
+    float getDroppedTime() const {
+        return droppedTime;
+    }
+
+private:
+    float step;
+    unsigned maxSteps;
+
+    float accumulator = 0;
+    float droppedTime = 0;
+};
+
+#endif // TIMESTEP_CPP
@@ -0,0 +1,66 @@
+#ifndef TRIPLE_BUFFER_CPP
+#define TRIPLE_BUFFER_CPP
+
+#include <atomic>
+
+/**
+ * Hands values over from one producer thread to one consumer thread without any lock.
+ *
+ * The producer fills the back buffer and publishes it, the consumer acquires the most recently
+ * published buffer and reads it. The third buffer sits in the middle, and each side swaps its own
+ * buffer with it through a single atomic exchange, so neither side ever waits for the other.
+ * The consumer may skip values if the producer is faster, and read the same one again if slower.
+ */
+template<typename T>
+class TripleBuffer {
+public:
+    /** The buffer the producer writes to. Only valid until the next publish. */
+    T &writeBuffer() {
+        return buffers[back];
+    }
+
+    /** Make the write buffer the latest value, and get a new one to write to. Producer side. */
+    void publish() {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    /**
+     * Take the latest published value if there is a new one since the last call. Consumer side.
+     * Returns false if nothing new was published, in which case the read buffer is unchanged.
+     */
+    bool acquire() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    /** The buffer the consumer reads from. Only valid until the next acquire. */
+    const T &readBuffer() const {
+        return buffers[front];
+    }
+
+    /**
+     * Call the given function on each of the three buffers, for instance to allocate their
+     * memory up front. Only while neither thread uses them.
+     */
+    template<typename Function>
+    void forEachBuffer(Function function) {
+        for (T &buffer : buffers) {
+            function(buffer);
+        }
+    }
+
+private:
+    /** Set on the middle index when it holds a value the consumer has not taken yet. */
+    static const unsigned FRESH = 4;
+    static const unsigned INDEX = 3;
+
+    T buffers[3];
+
+    unsigned front = 0;
+    std::atomic<unsigned> middle{1};
+    unsigned back = 2;
+};
+
+#endif // TRIPLE_BUFFER_CPP